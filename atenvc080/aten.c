@@ -5,6 +5,8 @@
 
 #include "mac.h"
 #include "aten.h"
+#include "edid.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -13,148 +15,260 @@
 
 
 
-int edidVerifyChecksum(uint8_t edid[ATEN_MAX_EDID_SIZE])
+static aten_policy_t atenPolicies[ATEN_POLICY_COUNT] =
 {
-    int blockCount = 1 + edid[ATEN_EXTENSION_COUNT_OFFSET];
-    int result = ATEN_NO_ERROR;
-    uint8_t foundChecksum;
+    [ATEN_POLICY_SWITCH]   = { 1, ATEN_SETTLE_TIME, 1.0, 0 },
+    [ATEN_POLICY_READ]     = { 1, ATEN_ACK_TIMEOUT, 1.0, 0 },
+    [ATEN_POLICY_DISPLAY]  = { 1, ATEN_ACK_TIMEOUT, 1.0, 0 },
+    [ATEN_POLICY_WRITE]    = { 1, ATEN_ACK_TIMEOUT, 1.0, 0 },
+    [ATEN_POLICY_FIRMWARE] = { 1, ATEN_FIRMWARE_TIMEOUT, 1.0, 0 },
+};
 
 
-    for (int block = 0; block < blockCount; block++)
-    {
-        uint8_t sum = 0;
-        size_t i;
 
+int atenSetPolicy(aten_policy_class_t policyClass, const aten_policy_t * policy)
+{
+    if (policyClass < 0 || policyClass >= ATEN_POLICY_COUNT)
+        return -1;
+    if (policy->attempts < 1 || policy->wait < 1 || !(policy->backoff >= 1.0))
+        return -1;
+    if (policyClass == ATEN_POLICY_WRITE && policy->attempts != 1)
+        return -1;
 
-        for (i = 0; i < ATEN_BLOCK_SIZE - 1; i++)
-            sum += edid[block * ATEN_BLOCK_SIZE + i];
+    atenPolicies[policyClass] = *policy;
 
-        foundChecksum = edid[block * ATEN_BLOCK_SIZE + ATEN_BLOCK_SIZE - 1];
-        if (sum != 0x100 - edid[block * ATEN_BLOCK_SIZE + ATEN_BLOCK_SIZE - 1])
-        {
-            fprintf(stderr, "At EDID offset 0x%02x, found checksum 0x%02x, expected 0x%02x.\n", block * ATEN_BLOCK_SIZE + ATEN_BLOCK_SIZE - 1, foundChecksum, 0x100 - sum);
-            result = ATEN_INVALID;
-        }
+    return 0;
+}
+
+
+
+const aten_policy_t * atenGetPolicy(aten_policy_class_t policyClass)
+{
+    return &atenPolicies[policyClass];
+}
+
+
+
+uintmax_t atenPolicyWait(aten_policy_class_t policyClass, unsigned attempt, uintmax_t start)
+{
+    const aten_policy_t * policy = &atenPolicies[policyClass];
+    double wait = policy->wait;
+    uintmax_t elapsed;
+
+
+    if (attempt >= policy->attempts)
+        return 0;
+
+    for (unsigned n = 0; n < attempt && wait < UINT32_MAX; n++)
+        wait *= policy->backoff;
+    if (wait > UINT32_MAX)
+        wait = UINT32_MAX;
+
+    if (policy->deadline == 0)
+        return (uintmax_t)wait;
+
+    elapsed = monotonicMilliseconds() - start;
+    if (elapsed >= policy->deadline)
+        return 0;
+
+    return (uintmax_t)wait < policy->deadline - elapsed ? (uintmax_t)wait : policy->deadline - elapsed;
+}
+
+
+
+// Record the operation in the trace, if any, and return its status.
+static int atenTrace(const char * operation, uintmax_t start, int status)
+{
+    traceEvent("aten", operation, start, "status", status);
+
+    return status;
+}
+
+
+
+// Wait for the device to send 'expected', dismissing any other byte.
+// Returns ATEN_TIMEOUT if it didn't come in time, ATEN_READ_ERROR as soon as the device hung up.
+static int atenWaitForByte(int serialDevice, uint8_t expected, uintmax_t milliseconds)
+{
+    uintmax_t deadline = monotonicMilliseconds() + milliseconds;
+    uintmax_t now;
+    serial_status_t status;
+
+
+    while ((now = monotonicMilliseconds()) < deadline)
+    {
+        if ((status = serialWaitForAvailableBytes(serialDevice, deadline - now)) == serialError)
+            return ATEN_READ_ERROR;
+        if (status != serialOK)
+            continue;
+
+        if (serialReadByte(serialDevice) == expected)
+            return ATEN_NO_ERROR;
     }
 
-    return result;
+    return ATEN_TIMEOUT;
 }
 
 
 
-int edidIsValid(uint8_t edid[ATEN_MAX_EDID_SIZE])
+// Send a command and wait for its acknowledgement, sending it again as the policy of its class allows, as long as
+// it times out. Only the command is attempted again: once acknowledged, the device is in the middle of the exchange.
+static int atenSendAcknowledgedCommand(int serialDevice, uint8_t command, aten_policy_class_t policyClass)
 {
-    int blockCount = 1 + edid[ATEN_EXTENSION_COUNT_OFFSET];
+    uintmax_t start = monotonicMilliseconds();
+    uintmax_t wait;
+    int status = ATEN_TIMEOUT;
+
+
+    for (unsigned attempt = 0; (wait = atenPolicyWait(policyClass, attempt, start)) > 0; attempt++)
+    {
+        if (attempt > 0)
+            serialClearPendingBytes(serialDevice);      // what is left of the previous attempt, dismiss errors
+        if (serialWriteByte(serialDevice, command) != serialOK)
+            return ATEN_WRITE_ERROR;
+        if ((status = atenWaitForByte(serialDevice, 0x05, wait)) != ATEN_TIMEOUT)
+            break;
+    }
+
+    return status;
+}
 
-    if (blockCount > 2)
-        return ATEN_INVALID;
 
-    return edidVerifyChecksum(edid);
+
+// Commands that get no acknowledgement are given some time to be processed.
+// Should the device reply anyway, don't wait longer than needed. Returns ATEN_READ_ERROR if the device hung up.
+static int atenSettle(int serialDevice)
+{
+    switch (serialWaitForAvailableBytes(serialDevice, atenPolicies[ATEN_POLICY_SWITCH].wait))
+    {
+    case serialOK:    serialReadByte(serialDevice); return ATEN_NO_ERROR;
+    case serialError: return ATEN_READ_ERROR;
+    default:          return ATEN_NO_ERROR;
+    }
 }
 
 
 
 int atenDeviceAttached(int serialDevice)
 {
-    int byte;
+    uintmax_t start = traceTime();
+
 
     if (serialWriteByte(serialDevice, 0x0b) != serialOK)
-        return -1;
+        return atenTrace("atenDeviceAttached", start, -1);
 
-    pauseMilliseconds(1000);
-    byte = serialReadByte(serialDevice);
+    if (serialWaitForAvailableBytes(serialDevice, ATEN_REPLY_TIMEOUT) != serialOK)
+        return atenTrace("atenDeviceAttached", start, -1);
 
-    return byte;
+    return atenTrace("atenDeviceAttached", start, serialReadByte(serialDevice));
 }
 
 
 
 int atenCECConnect(int serialDevice)
 {
-    if (serialWriteByte(serialDevice, 0x08) != serialOK)
-        return ATEN_WRITE_ERROR;
+    uintmax_t start = traceTime();
 
-    pauseMilliseconds(1000);
 
-    return ATEN_NO_ERROR;
+    if (serialWriteByte(serialDevice, 0x08) != serialOK)
+        return atenTrace("atenCECConnect", start, ATEN_WRITE_ERROR);
+
+    return atenTrace("atenCECConnect", start, atenSettle(serialDevice));
 }
 
 
 
 int atenCECDisconnect(int serialDevice)
 {
-    if (serialWriteByte(serialDevice, 0x09) != serialOK)
-        return ATEN_WRITE_ERROR;
+    uintmax_t start = traceTime();
 
-    pauseMilliseconds(1000);
 
-    return ATEN_NO_ERROR;
+    if (serialWriteByte(serialDevice, 0x09) != serialOK)
+        return atenTrace("atenCECDisconnect", start, ATEN_WRITE_ERROR);
+
+    return atenTrace("atenCECDisconnect", start, atenSettle(serialDevice));
 }
 
 
 
 int atenPosition(int serialDevice, int setID)
 {
+    uintmax_t start = traceTime();
     serial_status_t status;
 
     switch (setID)
     {
-    case ATEN_SET_DEFAULT: status = serialWriteByte(serialDevice, 0x01); pauseMilliseconds(1000); break;
-    case ATEN_SET_1:       status = serialWriteByte(serialDevice, 0x02); pauseMilliseconds(1000); break;
-    case ATEN_SET_2:       status = serialWriteByte(serialDevice, 0x03); pauseMilliseconds(1000); break;
-    case ATEN_SET_3:       status = serialWriteByte(serialDevice, 0x04); pauseMilliseconds(1000); break;
+    case ATEN_SET_DEFAULT: status = serialWriteByte(serialDevice, 0x01); break;
+    case ATEN_SET_1:       status = serialWriteByte(serialDevice, 0x02); break;
+    case ATEN_SET_2:       status = serialWriteByte(serialDevice, 0x03); break;
+    case ATEN_SET_3:       status = serialWriteByte(serialDevice, 0x04); break;
     default:               status = serialError; break;
     }
 
     if (status != serialOK)
-        return  ATEN_WRITE_ERROR;
+        return atenTrace("atenPosition", start, ATEN_WRITE_ERROR);
+
+    return atenTrace("atenPosition", start, atenSettle(serialDevice));
+}
+
 
-    return  ATEN_NO_ERROR;
+
+// ATEN_TIMEOUT or ATEN_READ_ERROR from serial status
+static int atenReadStatus(serial_status_t status)
+{
+    switch (status)
+    {
+    case serialOK:      return ATEN_NO_ERROR;
+    case serialTimeout: return ATEN_TIMEOUT;
+    default:            return ATEN_READ_ERROR;
+    }
 }
 
 
 
 int atenGetExtensionData(int serialDevice, int extension, uint8_t edid[ATEN_MAX_EDID_SIZE])
 {
-    if (serialWriteByte(serialDevice, 0x05) != serialOK)
-        return ATEN_READ_ERROR;
+    uintmax_t start = traceTime();
 
-    pauseMilliseconds(1000);
 
-    if (serialReadBytes(serialDevice, edid + (extension + 1) * ATEN_BLOCK_SIZE, ATEN_BLOCK_SIZE) != serialOK)
-        return ATEN_READ_ERROR;
+    if (serialWriteByte(serialDevice, 0x05) != serialOK)
+        return atenTrace("atenGetExtensionData", start, ATEN_READ_ERROR);
 
-    return ATEN_NO_ERROR;
+    return atenTrace("atenGetExtensionData", start, atenReadStatus(serialReadBytes(serialDevice, edid + (extension + 1) * ATEN_BLOCK_SIZE, ATEN_BLOCK_SIZE, ATEN_BLOCK_TIMEOUT)));
 }
 
 
 
-int atenReadEDIDFromDevice(int serialDevice, uint8_t edid[ATEN_MAX_EDID_SIZE])
+// command is 0x0c to read the selected set, 0x07 to read the connected display
+// extensions may then be fetched with atenGetExtensionData()
+static int atenReadBaseBlock(int serialDevice, uint8_t command, uint8_t edid[ATEN_MAX_EDID_SIZE])
 {
-    uint8_t byte;
-    int extensionBlockCount;
+    int status;
 
 
     bzero(edid, 2 * ATEN_BLOCK_SIZE);
 
-    if (serialWriteByte(serialDevice, 0x0c) != serialOK)
-        return ATEN_READ_ERROR;
+    if ((status = atenSendAcknowledgedCommand(serialDevice, command, command == 0x07 ? ATEN_POLICY_DISPLAY : ATEN_POLICY_READ)) != ATEN_NO_ERROR)
+        return status == ATEN_WRITE_ERROR ? ATEN_READ_ERROR : status;
 
-    pauseMilliseconds(1000);
+    return atenReadStatus(serialReadBytes(serialDevice, edid, ATEN_BLOCK_SIZE, ATEN_BLOCK_TIMEOUT));
+}
 
-    byte = serialReadByte(serialDevice);
-    if (byte != 0x05) { pauseMilliseconds(1000); byte = serialReadByte(serialDevice); }
-    if (byte != 0x05) { pauseMilliseconds(1000); byte = serialReadByte(serialDevice); }
-    if (byte != 0x05)
-        return ATEN_READ_ERROR;
 
-    if (serialReadBytes(serialDevice, edid, ATEN_BLOCK_SIZE) != serialOK)
-        return ATEN_READ_ERROR;
+
+static int atenReadEDID(int serialDevice, uint8_t command, uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    int extensionBlockCount;
+    int status;
+
+
+    if ((status = atenReadBaseBlock(serialDevice, command, edid)) != ATEN_NO_ERROR)
+        return status;
     extensionBlockCount = edid[ATEN_EXTENSION_COUNT_OFFSET];
     for (int extension = 0; extension < extensionBlockCount; extension++)
     {
-        if (atenGetExtensionData(serialDevice, extension, edid) != ATEN_NO_ERROR)
-            return ATEN_READ_ERROR;
+        if ((status = atenGetExtensionData(serialDevice, extension, edid)) != ATEN_NO_ERROR)
+            return status;
     }
 
     return edidIsValid(edid);
@@ -162,92 +276,77 @@ int atenReadEDIDFromDevice(int serialDevice, uint8_t edid[ATEN_MAX_EDID_SIZE])
 
 
 
+int atenReadEDIDFromDevice(int serialDevice, uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    uintmax_t start = traceTime();
+
+
+    return atenTrace("atenReadEDIDFromDevice", start, atenReadEDID(serialDevice, 0x0c, edid));
+}
+
+
+
 int atenReadEDIDFromDisplay(int serialDevice, uint8_t edid[ATEN_MAX_EDID_SIZE])
 {
-    int byte;
-    int extensionBlockCount;
+    uintmax_t start = traceTime();
 
 
-    bzero(edid, 2 * ATEN_BLOCK_SIZE);
+    return atenTrace("atenReadEDIDFromDisplay", start, atenReadEDID(serialDevice, 0x07, edid));
+}
 
-    if (serialWriteByte(serialDevice, 0x07) != serialOK)
-        return ATEN_READ_ERROR;
 
-    pauseMilliseconds(1000);
 
-    byte = serialReadByte(serialDevice);
-    if (byte != 0x05) { pauseMilliseconds(1000); byte = serialReadByte(serialDevice); }
-    if (byte != 0x05) { pauseMilliseconds(1000); byte = serialReadByte(serialDevice); }
-    if (byte != 0x05)
-        return ATEN_READ_ERROR;
+int atenReadBaseBlockFromDisplay(int serialDevice, uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    uintmax_t start = traceTime();
+    int status;
 
-    if (serialReadBytes(serialDevice, edid, ATEN_BLOCK_SIZE) != serialOK)
-        return ATEN_READ_ERROR;
-    extensionBlockCount = edid[ATEN_EXTENSION_COUNT_OFFSET];
-    for (int extension = 0; extension < extensionBlockCount; extension++)
-    {
-        if (atenGetExtensionData(serialDevice, extension, edid) != ATEN_NO_ERROR)
-            return ATEN_READ_ERROR;
-    }
 
-    return edidIsValid(edid);
+    if ((status = atenReadBaseBlock(serialDevice, 0x07, edid)) != ATEN_NO_ERROR)
+        return atenTrace("atenReadBaseBlockFromDisplay", start, status);
+
+    return atenTrace("atenReadBaseBlockFromDisplay", start, edidBlockSum(edid) == 0 ? ATEN_NO_ERROR : ATEN_INVALID);
 }
 
 
 
 int atenWriteEDID(int serialDevice, uint8_t edid[ATEN_MAX_EDID_SIZE])
 {
-    uint8_t byte;
+    uintmax_t start = traceTime();
     int extensionBlockCount;
+    int status;
 
 
     extensionBlockCount = edid[ATEN_EXTENSION_COUNT_OFFSET];
 
     if (extensionBlockCount > 1)
-        return ATEN_WRITE_ERROR;
+        return atenTrace("atenWriteEDID", start, ATEN_WRITE_ERROR);
 
-    if (serialWriteByte(serialDevice, 0x0a) != serialOK)
-        return ATEN_WRITE_ERROR;
-
-    pauseMilliseconds(1000);
-
-    byte = serialReadByte(serialDevice);
-    if (byte != 0x05) { pauseMilliseconds(1000); byte = serialReadByte(serialDevice); }
-    if (byte != 0x05) { pauseMilliseconds(1000); byte = serialReadByte(serialDevice); }
-    if (byte != 0x05)
-        return ATEN_WRITE_ERROR;
+    if ((status = atenSendAcknowledgedCommand(serialDevice, 0x0a, ATEN_POLICY_WRITE)) != ATEN_NO_ERROR)
+        return atenTrace("atenWriteEDID", start, status);
 
     // main EDID block
     if (serialWriteBytes(serialDevice, edid, ATEN_BLOCK_SIZE) != serialOK)
-        return ATEN_WRITE_ERROR;
-
-    pauseMilliseconds(1000);
+        return atenTrace("atenWriteEDID", start, ATEN_WRITE_ERROR);
 
-    byte = serialReadByte(serialDevice);
-    if (byte != 0x05) { pauseMilliseconds(1000); byte = serialReadByte(serialDevice); }
-    if (byte != 0x05) { pauseMilliseconds(1000); byte = serialReadByte(serialDevice); }
-    if (byte != 0x05)
-        return ATEN_WRITE_ERROR;
+    if ((status = atenWaitForByte(serialDevice, 0x05, atenPolicies[ATEN_POLICY_WRITE].wait)) != ATEN_NO_ERROR)
+        return atenTrace("atenWriteEDID", start, status);
 
     for (int extensionBlock = 0; extensionBlock < extensionBlockCount; extensionBlock++)
     {
         // extension EDID block
         if (serialWriteBytes(serialDevice, edid + (extensionBlock + 1) * ATEN_BLOCK_SIZE, ATEN_BLOCK_SIZE) != serialOK)
-            return ATEN_WRITE_ERROR;
+            return atenTrace("atenWriteEDID", start, ATEN_WRITE_ERROR);
 
-        pauseMilliseconds(1000);
-
-        byte = serialReadByte(serialDevice);
-        if (byte != 0x05) { pauseMilliseconds(1000); byte = serialReadByte(serialDevice); }
-        if (byte != 0x05) { pauseMilliseconds(1000); byte = serialReadByte(serialDevice); }
-        if (byte != 0x05)
-            return ATEN_WRITE_ERROR;
+        if ((status = atenWaitForByte(serialDevice, 0x05, atenPolicies[ATEN_POLICY_WRITE].wait)) != ATEN_NO_ERROR)
+            return atenTrace("atenWriteEDID", start, status);
     }
-    return ATEN_NO_ERROR;
+    return atenTrace("atenWriteEDID", start, ATEN_NO_ERROR);
 }
 
 
 
+// Returns ATEN_READ_ERROR if the file is missing or shorter than its blocks, ATEN_INVALID if a checksum is wrong.
 int atenReadEDIDFromFile(uint8_t edid[ATEN_MAX_EDID_SIZE], char * path)
 {
     int fileDescriptor;
@@ -257,20 +356,20 @@ int atenReadEDIDFromFile(uint8_t edid[ATEN_MAX_EDID_SIZE], char * path)
 
     fileDescriptor = open(path, O_RDONLY);
     if (fileDescriptor < 0)
-        return ATEN_INVALID;
+        return ATEN_READ_ERROR;
 
     byteCount = read(fileDescriptor, edid, ATEN_BLOCK_SIZE);
     if (byteCount != ATEN_BLOCK_SIZE)
     {
         close(fileDescriptor);
-        return ATEN_INVALID;
+        return ATEN_READ_ERROR;
     }
 
     extensionBlockCount = edid[ATEN_EXTENSION_COUNT_OFFSET];
     byteCount = read(fileDescriptor, edid + ATEN_BLOCK_SIZE, extensionBlockCount * ATEN_BLOCK_SIZE);
     close(fileDescriptor);
     if (byteCount != extensionBlockCount * ATEN_BLOCK_SIZE)
-        return ATEN_INVALID;
+        return ATEN_READ_ERROR;
 
     return edidIsValid(edid);
 }
@@ -344,21 +443,21 @@ int atenSendFirmwareModeCommand(int serialDevice, uint8_t * command, size_t byte
 
 
 
-int atenGetFirmwareModeReply(int serialDevice, uint8_t * reply, size_t byteCount)
+int atenGetFirmwareModeReply(int serialDevice, uint8_t * reply, size_t byteCount, uintmax_t milliseconds)
 {
-    if (byteCount < 2)
-        return ATEN_READ_ERROR;
+    int status;
 
-    while(serialPendingBytesCount(serialDevice) < 2)
-        pauseMilliseconds(50);
 
-    if (serialReadBytes(serialDevice, reply, 2) != serialOK)
+    if (byteCount < 2)
         return ATEN_READ_ERROR;
+
+    if ((status = atenReadStatus(serialReadBytes(serialDevice, reply, 2, milliseconds))) != ATEN_NO_ERROR)
+        return status;
     if (reply[0] != 'F' || reply[1] != 'U')
         return ATEN_READ_ERROR;
 
-    if (serialReadBytes(serialDevice, reply + 2, byteCount - 2) != serialOK)
-        return ATEN_READ_ERROR;
+    if ((status = atenReadStatus(serialReadBytes(serialDevice, reply + 2, byteCount - 2, ATEN_BLOCK_TIMEOUT))) != ATEN_NO_ERROR)
+        return status;
 
     if (atenVerifyFirmwareModeChecksum(reply, byteCount) != ATEN_NO_ERROR)
         return ATEN_READ_ERROR;
@@ -368,11 +467,98 @@ int atenGetFirmwareModeReply(int serialDevice, uint8_t * reply, size_t byteCount
 
 
 
-int atenUpdateFirmware(int serialDevice, uint8_t * data, size_t length)
+// Send a firmware mode frame and get its reply, sending it again as the firmware policy allows, as long as it times out.
+static int atenExchangeFirmwareModeFrame(int serialDevice, uint8_t * command, size_t commandByteCount, uint8_t * reply, size_t replyByteCount)
+{
+    uintmax_t start = monotonicMilliseconds();
+    uintmax_t wait;
+    int status = ATEN_TIMEOUT;
+
+
+    for (unsigned attempt = 0; (wait = atenPolicyWait(ATEN_POLICY_FIRMWARE, attempt, start)) > 0; attempt++)
+    {
+        if (attempt > 0)
+            serialClearPendingBytes(serialDevice);      // what is left of the previous attempt, dismiss errors
+        if (atenSendFirmwareModeCommand(serialDevice, command, commandByteCount) != ATEN_NO_ERROR)
+            return ATEN_WRITE_ERROR;
+        if ((status = atenGetFirmwareModeReply(serialDevice, reply, replyByteCount, wait)) != ATEN_TIMEOUT)
+            break;
+    }
+
+    return status;
+}
+
+
+
+// Account a data frame that has just been acknowledged.
+void atenFirmwareFrameDone(aten_firmware_progress_t * progress, uintmax_t frameStart, size_t byteCount, atenProgressFunction_t progressFunction, void * context)
+{
+    uintmax_t now = monotonicMilliseconds();
+
+
+    progress->byteCount += byteCount;
+    progress->frameCount++;
+    progress->elapsed = now - progress->start;
+    progress->roundTrip = now - frameStart;
+    progress->totalRoundTrip += progress->roundTrip;
+    if (progress->frameCount == 1 || progress->roundTrip < progress->minRoundTrip)
+        progress->minRoundTrip = progress->roundTrip;
+    if (progress->roundTrip > progress->maxRoundTrip)
+        progress->maxRoundTrip = progress->roundTrip;
+
+    if (progressFunction != NULL)
+        progressFunction(progress, context);
+}
+
+
+
+// Checks the length, signature and checksum of a firmware file.
+int atenVerifyFirmware(const uint8_t * data, size_t length)
 {
     uint16_t expectedSum;
     uint16_t sum;
+
+
+    if (length != ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2 + 2)
+        return ATEN_INVALID;
+
+    if (memcmp(data, "ATENVC060/080", 13))
+        return ATEN_INVALID;
+
+    sum = 0;
+    for (size_t i = 0; i < length - 2; i += 2)
+        sum += (data[i] << 8) | data[i + 1];
+    expectedSum = (data[length - 2] << 8) | data[length - 1];
+
+    if (sum != expectedSum)
+        return ATEN_INVALID;
+
+    return ATEN_NO_ERROR;
+}
+
+
+
+int atenUpdateFirmware(int serialDevice, uint8_t * data, size_t length, aten_firmware_progress_t * progress, atenProgressFunction_t progressFunction, void * context)
+{
+    return atenResumeFirmware(serialDevice, data, length, 0, NULL, progress, progressFunction, context);
+}
+
+
+
+// Each frame is sent as soon as the reply to the previous one is complete and valid.
+// progress may be NULL, it is filled in as data frames are acknowledged.
+// A resumed update skips the erase and the 0xa3 data frames before resumeOffset, a multiple of 64, which an interrupted
+// update had flashed, then sends the 0xa2 frame again. It only does so for the device the interrupted update was
+// flashing, whose reply to 0x90 DI is resumeIdentity: the update starts over from the erase for another device, or
+// should the device refuse the 0xa2 frame or the first data frame.
+int atenResumeFirmware(int serialDevice, uint8_t * data, size_t length, size_t resumeOffset, const uint8_t * resumeIdentity, aten_firmware_progress_t * progress, atenProgressFunction_t progressFunction, void * context)
+{
+    uintmax_t start = traceTime();
+    const char * operation = (resumeOffset > 0) ? "atenResumeFirmware" : "atenUpdateFirmware";
+    int status;
     uint8_t reply[256];
+    aten_firmware_progress_t localProgress;
+    uintmax_t frameStart;
     // command size is +1 for the checksum that will be computed in atenSendFirmwareModeCommand()
     uint8_t commandFU_ff_EN[ 5 + 1] = { 'F', 'U', 0xff, 'E', 'N' };
     uint8_t commandFU_80[27 + 1] = { 'F', 'U', 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
@@ -384,18 +570,12 @@ int atenUpdateFirmware(int serialDevice, uint8_t * data, size_t length)
     uint8_t commandFU_a5_AD[ 6 + 1] = { 'F', 'U', 0xa5, 0xff, 'A', 'D' };
 
 
-    if (length != ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2 + 2)
-        goto invalidData;
-
-    if (memcmp(data, "ATENVC060/080", 13))
-        goto invalidData;
-
-    sum = 0;
-    for (size_t i = 0; i < length - 2; i += 2)
-        sum += (data[i] << 8) | data[i + 1];
-    expectedSum = (data[length - 2] << 8) | data[length - 1];
+    if (progress == NULL)
+        progress = &localProgress;
+    bzero(progress, sizeof(aten_firmware_progress_t));
+    progress->totalByteCount = ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2;
 
-    if (sum != expectedSum)
+    if (atenVerifyFirmware(data, length) != ATEN_NO_ERROR || resumeOffset % 64 != 0 || resumeOffset > ATEN_FIRMWARE_SIZE_2)
         goto invalidData;
 
     if (serialSetRate(serialDevice, 19200, 19200) != serialOK)
@@ -408,75 +588,104 @@ int atenUpdateFirmware(int serialDevice, uint8_t * data, size_t length)
 
     if (atenSendFirmwareModeCommand(serialDevice, commandFU_ff_EN, sizeof(commandFU_ff_EN)) != ATEN_NO_ERROR)
         goto writeError;
-    pauseMilliseconds(1000);
-    if (serialPendingBytesCount(serialDevice) < 1)
-        goto readError;
-    if (atenGetFirmwareModeReply(serialDevice, reply, 32) != ATEN_NO_ERROR)
+    if (serialWaitForAvailableBytes(serialDevice, ATEN_REPLY_TIMEOUT) != serialOK)
         goto readError;
+    if ((status = atenGetFirmwareModeReply(serialDevice, reply, 32, ATEN_REPLY_TIMEOUT)) != ATEN_NO_ERROR)
+        goto end;
     if (reply[2] != (commandFU_ff_EN[2] ^ 0x80))
         goto readError;
 
-    if (atenSendFirmwareModeCommand(serialDevice, commandFU_80, sizeof(commandFU_80)) != ATEN_NO_ERROR)
-        goto writeError;
-    if (atenGetFirmwareModeReply(serialDevice, reply, 5) != ATEN_NO_ERROR)
-        goto writeError;
+    if ((status = atenExchangeFirmwareModeFrame(serialDevice, commandFU_80, sizeof(commandFU_80), reply, 5)) != ATEN_NO_ERROR)
+        goto replyError;
     if (reply[2] != (commandFU_80[2] ^ 0x80) || reply[3] != commandFU_80[3])
         goto writeError;
 
-    if (atenSendFirmwareModeCommand(serialDevice, commandFU_90_DI, sizeof(commandFU_90_DI)) != ATEN_NO_ERROR)
-        goto writeError;
-    if (atenGetFirmwareModeReply(serialDevice, reply, 50) != ATEN_NO_ERROR)
-        goto writeError;
+    if ((status = atenExchangeFirmwareModeFrame(serialDevice, commandFU_90_DI, sizeof(commandFU_90_DI), reply, 50)) != ATEN_NO_ERROR)
+        goto replyError;
     if (reply[2] != (commandFU_90_DI[2] ^ 0x80) || reply[3] != commandFU_90_DI[3] || memcmp(reply + 4, "VC060/080", 9))
         goto readError;
     printf("Device status before upgrade:\n");
     printf("         CPU is: %.7s\n", reply + 42);
     printf("   firmware was: v%c.%c.%c%c%c\n", reply[28], reply[29], reply[31], reply[32], reply[33]);
     printf("  microcode was: v%c.%c.%c%c%c\n", reply[35], reply[36], reply[38], reply[39], reply[40]);
+    memcpy(progress->deviceIdentity, reply + 4, ATEN_FIRMWARE_IDENTITY_SIZE);
 
-    if (atenSendFirmwareModeCommand(serialDevice, commandFU_a0_CT, sizeof(commandFU_a0_CT)) != ATEN_NO_ERROR)
-        goto writeError;
-    if (atenGetFirmwareModeReply(serialDevice, reply, 6) != ATEN_NO_ERROR)
-        goto writeError;
+    if (resumeOffset > 0 && (resumeIdentity == NULL || memcmp(resumeIdentity, progress->deviceIdentity, ATEN_FIRMWARE_IDENTITY_SIZE) != 0))
+    {
+        printf("Device isn't the one whose update was interrupted, starting over\n");
+        resumeOffset = 0;
+    }
+    if (resumeOffset > 0)
+    {
+        progress->byteCount = resumeOffset;
+        progress->resumedByteCount = resumeOffset;
+        goto resume;
+    }
+
+restart:
+    if ((status = atenExchangeFirmwareModeFrame(serialDevice, commandFU_a0_CT, sizeof(commandFU_a0_CT), reply, 6)) != ATEN_NO_ERROR)
+        goto replyError;
     if (reply[2] != (commandFU_a0_CT[2] ^ 0x80) || reply[3] != commandFU_a0_CT[3] || reply[4] != 0x00)
         goto writeError;
 
+resume:
     memcpy(commandFU_a2 + 4, data, ATEN_FIRMWARE_SIZE_1);
-    if (atenSendFirmwareModeCommand(serialDevice, commandFU_a2, sizeof(commandFU_a2)) != ATEN_NO_ERROR)
-        goto writeError;
-    if (atenGetFirmwareModeReply(serialDevice, reply, 6) != ATEN_NO_ERROR)
-        goto writeError;
+    progress->start = monotonicMilliseconds();
+    frameStart = progress->start;
+    if ((status = atenExchangeFirmwareModeFrame(serialDevice, commandFU_a2, sizeof(commandFU_a2), reply, 6)) != ATEN_NO_ERROR)
+        goto replyError;
     if (reply[2] != (commandFU_a2[2] ^ 0x80) || reply[3] != commandFU_a2[3] || reply[4] != 0x00)
+    {
+        if (resumeOffset > 0)
+            goto startOver;
         goto writeError;
+    }
+    atenFirmwareFrameDone(progress, frameStart, ATEN_FIRMWARE_SIZE_1, progressFunction, context);
 
-    for (size_t offset = 0; offset < ATEN_FIRMWARE_SIZE_2; offset += 64)
+    for (size_t offset = resumeOffset; offset < ATEN_FIRMWARE_SIZE_2; offset += 64)
     {
         commandFU_a3[4] = (offset / 64) >> 8;
         commandFU_a3[5] = (offset / 64);
         memcpy(commandFU_a3 + 6, data + ATEN_FIRMWARE_SIZE_1 + offset, 64);
-        if (atenSendFirmwareModeCommand(serialDevice, commandFU_a3, sizeof(commandFU_a3)) != ATEN_NO_ERROR)
-            goto writeError;
-        if (atenGetFirmwareModeReply(serialDevice, reply, 8) != ATEN_NO_ERROR)
-            goto writeError;
+        frameStart = monotonicMilliseconds();
+        if ((status = atenExchangeFirmwareModeFrame(serialDevice, commandFU_a3, sizeof(commandFU_a3), reply, 8)) != ATEN_NO_ERROR)
+            goto replyError;
         if (reply[2] != (commandFU_a3[2] ^ 0x80) || reply[3] != commandFU_a3[3] || reply[4] != (commandFU_a3[4]) || reply[5] != commandFU_a3[5] || reply[6] != 0x00)
+        {
+            if (offset > 0 && offset == resumeOffset)
+                goto startOver;
             goto writeError;
+        }
+        atenFirmwareFrameDone(progress, frameStart, 64, progressFunction, context);
     }
 
-    if (atenSendFirmwareModeCommand(serialDevice, commandFU_a4_DT, sizeof(commandFU_a4_DT)) != ATEN_NO_ERROR)
-        goto writeError;
-    if (atenGetFirmwareModeReply(serialDevice, reply, 6) != ATEN_NO_ERROR)
-        goto writeError;
+    if ((status = atenExchangeFirmwareModeFrame(serialDevice, commandFU_a4_DT, sizeof(commandFU_a4_DT), reply, 6)) != ATEN_NO_ERROR)
+        goto replyError;
     if (reply[2] != (commandFU_a4_DT[2] ^ 0x80) || reply[3] != commandFU_a4_DT[3] || reply[4] != 0x00)
         goto writeError;
 
-    if (atenSendFirmwareModeCommand(serialDevice, commandFU_a5_AD, sizeof(commandFU_a5_AD)) != ATEN_NO_ERROR)
-        goto writeError;
-    if (atenGetFirmwareModeReply(serialDevice, reply, 6) != ATEN_NO_ERROR)
-        goto writeError;
+    if ((status = atenExchangeFirmwareModeFrame(serialDevice, commandFU_a5_AD, sizeof(commandFU_a5_AD), reply, 6)) != ATEN_NO_ERROR)
+        goto replyError;
     if (reply[2] != (commandFU_a5_AD[2] ^ 0x80) || reply[3] != 0x00 || reply[4] != 0x00)
         goto writeError;
 
-    int status = ATEN_NO_ERROR;
+    status = ATEN_NO_ERROR;
+    goto end;
+
+startOver:
+    printf("Device can't resume the interrupted update, starting over\n");
+    resumeOffset = 0;
+    progress->byteCount = 0;
+    progress->resumedByteCount = 0;
+    progress->frameCount = 0;
+    progress->totalRoundTrip = 0;
+    progress->minRoundTrip = 0;
+    progress->maxRoundTrip = 0;
+    goto restart;
+
+replyError:
+    if (status != ATEN_TIMEOUT)
+        status = ATEN_WRITE_ERROR;
     goto end;
 
 invalidData:
@@ -497,5 +706,5 @@ end:
     pauseMilliseconds(100);
     serialClearPendingBytes(serialDevice);         // purge serial input buffer, dismiss errors
 
-    return status;
+    return atenTrace(operation, start, status);
 }
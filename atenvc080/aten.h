@@ -9,6 +9,10 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 
 
 typedef enum
@@ -24,6 +28,7 @@ typedef enum
 #define ATEN_INVALID                    1
 #define ATEN_WRITE_ERROR                2
 #define ATEN_READ_ERROR                 3
+#define ATEN_TIMEOUT                    4       // the device didn't reply in time
 
 #define ATEN_BLOCK_SIZE                 128
 #define ATEN_MAX_EXTENSION_COUNT        255
@@ -31,16 +36,70 @@ typedef enum
 
 #define ATEN_EXTENSION_COUNT_OFFSET     0x7e
 
+// timings, in milliseconds, those of the policies are defaults
+#define ATEN_REPLY_TIMEOUT              1000    // maximum wait for a reply to identification or firmware mode requests
+#define ATEN_ACK_TIMEOUT                3000    // maximum wait for the 0x05 acknowledgement
+#define ATEN_SETTLE_TIME                1000    // time given to commands that get no acknowledgement
+#define ATEN_BLOCK_TIMEOUT              1000    // maximum wait for an EDID block, once it started
+#define ATEN_FIRMWARE_TIMEOUT           10000   // maximum wait for a firmware mode reply, flash erase and write included
+
 #define ATEN_FIRMWARE_SIZE_1            0x40
 #define ATEN_FIRMWARE_SIZE_2            0x2a40
+#define ATEN_FIRMWARE_IDENTITY_SIZE     45      // bytes of the reply to 0x90 DI, from the model name to the CPU name
 
 
-int edidVerifyChecksum(uint8_t edid[ATEN_MAX_EDID_SIZE]);
-int edidIsValid(uint8_t edid[ATEN_MAX_EDID_SIZE]);
+
+// firmware upload statistics, times are in milliseconds
+typedef struct
+{
+    size_t byteCount;               // firmware bytes acknowledged by the device
+    size_t resumedByteCount;        // of them, acknowledged before an interruption, when resumed
+    size_t totalByteCount;
+    size_t frameCount;              // data frames acknowledged
+    uintmax_t start;                // monotonic time the first data frame was sent
+    uintmax_t elapsed;
+    uintmax_t roundTrip;            // of the last frame
+    uintmax_t minRoundTrip;
+    uintmax_t maxRoundTrip;
+    uintmax_t totalRoundTrip;
+    uint8_t deviceIdentity[ATEN_FIRMWARE_IDENTITY_SIZE];     // replied to 0x90 DI
+} aten_firmware_progress_t;
+
+// called after each acknowledged data frame
+typedef void (*atenProgressFunction_t)(const aten_firmware_progress_t * progress, void * context);
+
+// Classes of operations sharing a policy of waits and retries.
+typedef enum
+{
+    ATEN_POLICY_SWITCH = 0,         // set selection and CEC, not acknowledged: only the wait applies, as settle time
+    ATEN_POLICY_READ,               // acknowledgement of set reads
+    ATEN_POLICY_DISPLAY,            // acknowledgement of display reads, fetched from the display over DDC
+    ATEN_POLICY_WRITE,              // acknowledgements of EDID writes, a single attempt
+    ATEN_POLICY_FIRMWARE,           // replies to firmware mode frames
+    ATEN_POLICY_COUNT,
+} aten_policy_class_t;
+
+// Attempt n, from 0, waits wait * backoff^n milliseconds. A command whose acknowledgement, or a firmware frame whose
+// reply, timed out is sent again until attempts are exhausted or deadline milliseconds passed, 0 for none.
+// A write command is never sent again: were its acknowledgement only late, the device would take the second 0x0a as
+// the first byte of the EDID, and every block would be shifted by one.
+typedef struct
+{
+    unsigned attempts;
+    uintmax_t wait;
+    double backoff;
+    uintmax_t deadline;
+} aten_policy_t;
+
+
+int atenSetPolicy(aten_policy_class_t policyClass, const aten_policy_t * policy);     // returns -1 if invalid
+const aten_policy_t * atenGetPolicy(aten_policy_class_t policyClass);
+uintmax_t atenPolicyWait(aten_policy_class_t policyClass, unsigned attempt, uintmax_t start);  // 0 if no attempt is left
 
 int atenPosition(int serialDevice, aten_set_id setID);
 int atenGetExtensionData(int serialDevice, int extension, uint8_t edid[ATEN_MAX_EDID_SIZE]);
 int atenReadEDIDFromDisplay(int serialDevice, uint8_t edid[ATEN_MAX_EDID_SIZE]);
+int atenReadBaseBlockFromDisplay(int serialDevice, uint8_t edid[ATEN_MAX_EDID_SIZE]);     // extensions are left to atenGetExtensionData()
 int atenCECConnect(int serialDevice);
 int atenCECDisconnect(int serialDevice);
 int atenWriteEDID(int serialDevice, uint8_t edid[ATEN_MAX_EDID_SIZE]);
@@ -50,6 +109,15 @@ int atenReadEDIDFromDevice(int serialDevice, uint8_t edid[ATEN_MAX_EDID_SIZE]);
 int atenReadEDIDFromFile(uint8_t edid[ATEN_MAX_EDID_SIZE], char * path);
 int atenWriteEDIDToFile(uint8_t edid[ATEN_MAX_EDID_SIZE], char * path);
 
-int atenUpdateFirmware(int serialDevice, uint8_t data[ATEN_FIRMWARE_SIZE_1], size_t length);
+void atenAppendFirmwareModeChecksum(uint8_t * data, size_t byteCount);
+int atenVerifyFirmwareModeChecksum(uint8_t * data, size_t byteCount);
+void atenFirmwareFrameDone(aten_firmware_progress_t * progress, uintmax_t frameStart, size_t byteCount, atenProgressFunction_t progressFunction, void * context);
+int atenVerifyFirmware(const uint8_t * data, size_t length);
+int atenUpdateFirmware(int serialDevice, uint8_t * data, size_t length, aten_firmware_progress_t * progress, atenProgressFunction_t progressFunction, void * context);
+int atenResumeFirmware(int serialDevice, uint8_t * data, size_t length, size_t resumeOffset, const uint8_t * resumeIdentity, aten_firmware_progress_t * progress, atenProgressFunction_t progressFunction, void * context);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* aten_h */
@@ -0,0 +1,184 @@
+//
+//  cache.c
+//  atenvc080
+//
+
+#include "cache.h"
+#include "edid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+
+// A cache entry holds the EDID blocks followed by their 8 bytes digest, most significant byte first.
+#define CACHE_DIGEST_SIZE       8
+
+
+
+static int cacheMakeDirectory(char * path)
+{
+    for (char * slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        if (mkdir(path, 0755) == -1 && errno != EEXIST)
+            return -1;
+        *slash = '/';
+    }
+
+    if (mkdir(path, 0755) == -1 && errno != EEXIST)
+        return -1;
+
+    return 0;
+}
+
+
+
+// path of the file name in the directory of the device, the directory is created if needed
+int cacheDevicePath(char path[PATH_MAX], const char * devicePath, const char * name)
+{
+    const char * base = getenv("XDG_CACHE_HOME");
+    char deviceKey[NAME_MAX];
+    size_t i;
+    int length;
+
+
+    // /dev/cu.usbserial-1 becomes _dev_cu.usbserial-1
+    for (i = 0; devicePath[i] != '\0' && i < sizeof(deviceKey) - 1; i++)
+        deviceKey[i] = (devicePath[i] == '/') ? '_' : devicePath[i];
+    deviceKey[i] = '\0';
+
+    if (base != NULL && base[0] == '/')
+        length = snprintf(path, PATH_MAX, "%s/atenvc080/%s", base, deviceKey);
+    else if (getenv("HOME") != NULL)
+        length = snprintf(path, PATH_MAX, "%s/.cache/atenvc080/%s", getenv("HOME"), deviceKey);
+    else
+        return -1;
+    if (length < 0 || length >= PATH_MAX - 1 - (int) strlen(name))
+        return -1;
+
+    if (cacheMakeDirectory(path) != 0)
+        return -1;
+
+    snprintf(path + length, PATH_MAX - length, "/%s", name);
+
+    return 0;
+}
+
+
+
+// path of the entry of the given set
+static int cachePath(char path[PATH_MAX], const char * devicePath, int position)
+{
+    char name[8];
+
+
+    if (position < ATEN_SET_DEFAULT || position > ATEN_SET_3)
+        return -1;
+
+    snprintf(name, sizeof(name), "set%d", position);
+
+    return cacheDevicePath(path, devicePath, name);
+}
+
+
+
+// returns 0 if a valid entry, not older than maxAge seconds, was found
+int cacheLoad(const char * devicePath, int position, uint8_t edid[ATEN_MAX_EDID_SIZE], long maxAge)
+{
+    char path[PATH_MAX];
+    uint8_t entry[ATEN_MAX_EDID_SIZE + CACHE_DIGEST_SIZE];
+    struct stat status;
+    int fileDescriptor;
+    ssize_t byteCount;
+    size_t edidSize;
+    uint64_t digest = 0;
+
+
+    if (maxAge < 0 || cachePath(path, devicePath, position) != 0)
+        return -1;
+
+    fileDescriptor = open(path, O_RDONLY);
+    if (fileDescriptor < 0)
+        return -1;
+
+    if (fstat(fileDescriptor, &status) != 0 || time(NULL) - status.st_mtime > maxAge)
+    {
+        close(fileDescriptor);
+        return -1;
+    }
+
+    byteCount = read(fileDescriptor, entry, sizeof(entry));
+    close(fileDescriptor);
+
+    if (byteCount < ATEN_BLOCK_SIZE + CACHE_DIGEST_SIZE)
+        return -1;
+    edidSize = (1 + entry[ATEN_EXTENSION_COUNT_OFFSET]) * ATEN_BLOCK_SIZE;
+    if ((size_t) byteCount != edidSize + CACHE_DIGEST_SIZE)
+        return -1;
+
+    for (int i = 0; i < CACHE_DIGEST_SIZE; i++)
+        digest = (digest << 8) | entry[edidSize + i];
+    if (digest != edidDigest(entry))
+        return -1;
+
+    memcpy(edid, entry, edidSize);
+
+    return edidIsValid(edid) == ATEN_NO_ERROR ? 0 : -1;
+}
+
+
+
+int cacheStore(const char * devicePath, int position, uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    char path[PATH_MAX];
+    char temporaryPath[PATH_MAX + 8];
+    uint8_t entry[ATEN_MAX_EDID_SIZE + CACHE_DIGEST_SIZE];
+    size_t edidSize = (1 + edid[ATEN_EXTENSION_COUNT_OFFSET]) * ATEN_BLOCK_SIZE;
+    uint64_t digest = edidDigest(edid);
+    int fileDescriptor;
+    ssize_t byteCount;
+
+
+    if (cachePath(path, devicePath, position) != 0)
+        return -1;
+
+    memcpy(entry, edid, edidSize);
+    for (int i = CACHE_DIGEST_SIZE - 1; i >= 0; i--, digest >>= 8)
+        entry[edidSize + i] = (uint8_t) digest;
+
+    // readers never see a partial entry
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.%d", path, (int) getpid());
+    fileDescriptor = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fileDescriptor < 0)
+        return -1;
+
+    byteCount = write(fileDescriptor, entry, edidSize + CACHE_DIGEST_SIZE);
+    close(fileDescriptor);
+
+    if (byteCount != (ssize_t) (edidSize + CACHE_DIGEST_SIZE) || rename(temporaryPath, path) != 0)
+    {
+        unlink(temporaryPath);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+void cacheInvalidate(const char * devicePath, int position)
+{
+    char path[PATH_MAX];
+
+
+    if (cachePath(path, devicePath, position) == 0)
+        unlink(path);
+}
@@ -0,0 +1,30 @@
+//
+//  cache.h
+//  atenvc080
+//
+
+// On-disk cache of the EDID of each set of each device,
+// under $XDG_CACHE_HOME/atenvc080 (or ~/.cache/atenvc080).
+// Devices are identified by the path used to open them, prefer stable paths
+// such as /dev/cu.usbserial-<serial number> or /dev/serial/by-id/...
+
+#ifndef cache_h
+#define cache_h
+
+#include "aten.h"
+
+#include <stdint.h>
+#include <limits.h>
+
+
+
+#define CACHE_NO_MAX_AGE        (-1L)           // don't read from cache
+
+
+
+int cacheLoad(const char * devicePath, int position, uint8_t edid[ATEN_MAX_EDID_SIZE], long maxAge);
+int cacheStore(const char * devicePath, int position, uint8_t edid[ATEN_MAX_EDID_SIZE]);
+void cacheInvalidate(const char * devicePath, int position);
+int cacheDevicePath(char path[PATH_MAX], const char * devicePath, const char * name);     // for other files kept per device
+
+#endif /* cache_h */
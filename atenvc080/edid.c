@@ -0,0 +1,413 @@
+//
+//  edid.c
+//  atenvc080
+//
+
+#include "edid.h"
+
+#include <stdio.h>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+
+#define EDID_DESCRIPTOR_OFFSET          0x36
+#define EDID_DESCRIPTOR_SIZE            18
+#define EDID_DESCRIPTOR_COUNT           4
+
+
+
+// Sum of the 128 bytes of a block, modulo 256, checksum included.
+// SAD against zero adds 8 bytes at once into 64 bits lanes, a block takes 4 (AVX2) or 8 (SSE2) of them.
+// Other processors, such as ARM, get a plain loop that compilers vectorize at -O2.
+#if defined(__AVX2__)
+uint8_t edidBlockSum(const uint8_t block[ATEN_BLOCK_SIZE])
+{
+    __m256i sums = _mm256_setzero_si256();
+    __m128i halves;
+
+
+    for (size_t i = 0; i < ATEN_BLOCK_SIZE; i += 32)
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *) (block + i)), _mm256_setzero_si256()));
+    halves = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+
+    return (uint8_t) (_mm_cvtsi128_si32(halves) + _mm_extract_epi16(halves, 4));
+}
+#elif defined(__SSE2__)
+uint8_t edidBlockSum(const uint8_t block[ATEN_BLOCK_SIZE])
+{
+    __m128i sums = _mm_setzero_si128();
+
+
+    for (size_t i = 0; i < ATEN_BLOCK_SIZE; i += 16)
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (block + i)), _mm_setzero_si128()));
+
+    return (uint8_t) (_mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4));
+}
+#else
+uint8_t edidBlockSum(const uint8_t block[ATEN_BLOCK_SIZE])
+{
+    unsigned int sum = 0;
+
+
+    for (size_t i = 0; i < ATEN_BLOCK_SIZE; i++)
+        sum += block[i];
+
+    return (uint8_t) sum;
+}
+#endif
+
+
+
+int edidVerifyChecksum(uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    int blockCount = 1 + edid[ATEN_EXTENSION_COUNT_OFFSET];
+
+
+    for (int block = 0; block < blockCount; block++)
+        if (edidBlockSum(edid + block * ATEN_BLOCK_SIZE) != 0)
+            return ATEN_INVALID;
+
+    return ATEN_NO_ERROR;
+}
+
+
+
+// Only checksums are verified, so that any EDID a device holds can be read and saved.
+// The device limit of one extension block is checked when writing.
+int edidIsValid(uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    return edidVerifyChecksum(edid);
+}
+
+
+
+static void edidAddIssue(edid_info_t * info, edid_error_t error, size_t offset, uint8_t found, uint8_t expected)
+{
+    if (error != EDID_UNKNOWN_EXTENSION)
+        info->errorCount++;
+
+    if (info->issueCount < EDID_MAX_ISSUES)
+    {
+        edid_issue_t * issue = &info->issues[info->issueCount];
+
+
+        issue->error = error;
+        issue->block = (int) (offset / ATEN_BLOCK_SIZE);
+        issue->offset = offset;
+        issue->found = found;
+        issue->expected = expected;
+    }
+    info->issueCount++;
+}
+
+
+
+// descriptor text is terminated by 0x0a and padded with spaces
+static void edidDescriptorText(char text[14], const uint8_t * descriptor)
+{
+    size_t length;
+
+
+    for (length = 0; length < 13 && descriptor[5 + length] != 0x0a; length++)
+        text[length] = (descriptor[5 + length] >= 0x20 && descriptor[5 + length] < 0x7f) ? descriptor[5 + length] : '?';
+    while (length > 0 && text[length - 1] == ' ')
+        length--;
+    text[length] = '\0';
+}
+
+
+
+static void edidDecodeBase(const uint8_t * edid, edid_info_t * info)
+{
+    static const uint8_t header[] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+    uint16_t manufacturer = (edid[0x08] << 8) | edid[0x09];
+    int validManufacturer = 1;
+
+
+    for (size_t i = 0; i < sizeof(header); i++)
+    {
+        if (edid[i] != header[i])
+        {
+            edidAddIssue(info, EDID_BAD_HEADER, i, edid[i], header[i]);
+            break;
+        }
+    }
+
+    for (int letter = 0; letter < 3; letter++)
+    {
+        int value = (manufacturer >> (10 - 5 * letter)) & 0x1f;
+
+
+        if (value < 1 || value > 26)
+        {
+            validManufacturer = 0;
+            value = '?' - 'A' + 1;
+        }
+        info->manufacturer[letter] = 'A' + value - 1;
+    }
+    info->manufacturer[3] = '\0';
+    if (!validManufacturer)
+        edidAddIssue(info, EDID_BAD_MANUFACTURER, 0x08, edid[0x08], edid[0x08]);
+
+    info->product = edid[0x0a] | (edid[0x0b] << 8);
+    info->serialNumber = edid[0x0c] | (edid[0x0d] << 8) | (edid[0x0e] << 16) | ((uint32_t) edid[0x0f] << 24);
+    info->week = edid[0x10];
+    info->year = 1990 + edid[0x11];
+    info->version = edid[0x12];
+    info->revision = edid[0x13];
+    if (info->version != 1)
+        edidAddIssue(info, EDID_BAD_VERSION, 0x12, edid[0x12], 1);
+
+    for (int i = 0; i < EDID_DESCRIPTOR_COUNT; i++)
+    {
+        const uint8_t * descriptor = edid + EDID_DESCRIPTOR_OFFSET + i * EDID_DESCRIPTOR_SIZE;
+
+
+        if (descriptor[0] != 0 || descriptor[1] != 0)
+            continue;       // detailed timing
+
+        if (descriptor[3] == 0xfc)
+            edidDescriptorText(info->name, descriptor);
+        else if (descriptor[3] == 0xff)
+            edidDescriptorText(info->serialText, descriptor);
+    }
+}
+
+
+
+// Data blocks lie from byte 4 up to the DTD offset, detailed timings from there to the checksum.
+static void edidDecodeCTA(const uint8_t * block, size_t blockOffset, edid_info_t * info)
+{
+    uint8_t dtdOffset = block[2];
+    size_t i;
+
+
+    if (info->ctaCount++ == 0)
+        info->ctaRevision = block[1];
+
+    if (dtdOffset == 0)
+        return;         // neither data blocks nor detailed timings
+
+    if (dtdOffset < 4 || dtdOffset > ATEN_BLOCK_SIZE - 1)
+    {
+        edidAddIssue(info, EDID_BAD_CTA, blockOffset + 2, dtdOffset, 4);
+        return;
+    }
+
+    for (i = 4; i < dtdOffset; i += 1 + (block[i] & 0x1f))
+    {
+        size_t length = block[i] & 0x1f;
+        int tag = block[i] >> 5;
+
+
+        if (i + 1 + length > dtdOffset)
+        {
+            edidAddIssue(info, EDID_BAD_CTA, blockOffset + i, block[i], (uint8_t) (dtdOffset - i - 1));
+            return;
+        }
+
+        // vendor-specific data block with the HDMI Licensing OUI 00-0C-03
+        if (tag == 3 && length >= 3 && block[i + 1] == 0x03 && block[i + 2] == 0x0c && block[i + 3] == 0x00)
+            info->hdmi = 1;
+        info->ctaDataBlockCount++;
+    }
+
+    for (i = dtdOffset; i + EDID_DESCRIPTOR_SIZE <= ATEN_BLOCK_SIZE - 1; i += EDID_DESCRIPTOR_SIZE)
+    {
+        if (block[i] == 0 && block[i + 1] == 0)
+            break;      // padding
+        info->ctaDetailedTimingCount++;
+    }
+}
+
+
+
+// A DisplayID section starts at byte 1: version, payload length, product type, extension count,
+// data blocks, then the section checksum.
+static void edidDecodeDisplayID(const uint8_t * block, size_t blockOffset, edid_info_t * info)
+{
+    size_t sectionEnd = 5 + block[2];       // offset of the section checksum
+    uint8_t sum = 0;
+    size_t i;
+
+
+    if (info->displayIDCount++ == 0)
+        info->displayIDVersion = block[1];
+
+    if (sectionEnd > ATEN_BLOCK_SIZE - 2)
+    {
+        edidAddIssue(info, EDID_BAD_DISPLAYID, blockOffset + 2, block[2], ATEN_BLOCK_SIZE - 7);
+        return;
+    }
+
+    for (i = 1; i <= sectionEnd; i++)
+        sum += block[i];
+    if (sum != 0)
+    {
+        edidAddIssue(info, EDID_BAD_DISPLAYID, blockOffset + sectionEnd, block[sectionEnd], (uint8_t) (block[sectionEnd] - sum));
+        return;
+    }
+
+    // data blocks have a tag, a revision and a payload length
+    for (i = 5; i + 3 <= sectionEnd; i += 3 + block[i + 2])
+    {
+        if (block[i] == 0 && block[i + 1] == 0 && block[i + 2] == 0)
+            break;      // padding
+        if (i + 3 + block[i + 2] > sectionEnd)
+        {
+            edidAddIssue(info, EDID_BAD_DISPLAYID, blockOffset + i + 2, block[i + 2], (uint8_t) (sectionEnd - i - 3));
+            return;
+        }
+        info->displayIDDataBlockCount++;
+    }
+}
+
+
+
+int edidValidate(const uint8_t * edid, size_t byteCount, edid_info_t * info)
+{
+    edid_info_t localInfo;
+    int blockCount;
+
+
+    if (info == NULL)
+        info = &localInfo;
+    bzero(info, sizeof(edid_info_t));
+
+    if (byteCount < ATEN_BLOCK_SIZE)
+    {
+        edidAddIssue(info, EDID_TRUNCATED, byteCount, 0, 0);
+        return ATEN_INVALID;
+    }
+
+    blockCount = 1 + edid[ATEN_EXTENSION_COUNT_OFFSET];
+    if (byteCount < (size_t) blockCount * ATEN_BLOCK_SIZE)
+    {
+        edidAddIssue(info, EDID_TRUNCATED, byteCount, (uint8_t) (byteCount / ATEN_BLOCK_SIZE), (uint8_t) blockCount);
+        blockCount = (int) (byteCount / ATEN_BLOCK_SIZE);
+    }
+    info->blockCount = blockCount;
+
+    for (int block = 0; block < blockCount; block++)
+    {
+        const uint8_t * bytes = edid + block * ATEN_BLOCK_SIZE;
+        uint8_t sum = edidBlockSum(bytes);
+
+
+        if (sum != 0)
+            edidAddIssue(info, EDID_BAD_CHECKSUM, block * ATEN_BLOCK_SIZE + ATEN_BLOCK_SIZE - 1, bytes[ATEN_BLOCK_SIZE - 1], (uint8_t) (bytes[ATEN_BLOCK_SIZE - 1] - sum));
+    }
+
+    edidDecodeBase(edid, info);
+
+    for (int block = 1; block < blockCount; block++)
+    {
+        const uint8_t * bytes = edid + block * ATEN_BLOCK_SIZE;
+
+
+        switch (bytes[0])
+        {
+        case EDID_TAG_CTA:
+            edidDecodeCTA(bytes, block * ATEN_BLOCK_SIZE, info);
+            break;
+        case EDID_TAG_DISPLAYID:
+            edidDecodeDisplayID(bytes, block * ATEN_BLOCK_SIZE, info);
+            break;
+        case EDID_TAG_VTB:
+        case EDID_TAG_DI:
+        case EDID_TAG_LS:
+        case EDID_TAG_DPVL:
+        case EDID_TAG_BLOCK_MAP:
+        case EDID_TAG_MANUFACTURER:
+            break;
+        default:
+            edidAddIssue(info, EDID_UNKNOWN_EXTENSION, block * ATEN_BLOCK_SIZE, bytes[0], bytes[0]);
+            break;
+        }
+    }
+
+    return info->errorCount == 0 ? ATEN_NO_ERROR : ATEN_INVALID;
+}
+
+
+
+// 64 bits FNV-1a digest
+uint64_t edidDigestBytes(const uint8_t * bytes, size_t byteCount)
+{
+    uint64_t digest = 0xcbf29ce484222325;
+
+
+    for (size_t i = 0; i < byteCount; i++)
+    {
+        digest ^= bytes[i];
+        digest *= 0x100000001b3;
+    }
+
+    return digest;
+}
+
+
+
+// digest of the EDID blocks
+uint64_t edidDigest(uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    return edidDigestBytes(edid, (1 + edid[ATEN_EXTENSION_COUNT_OFFSET]) * ATEN_BLOCK_SIZE);
+}
+
+
+
+// returns 0 when both EDIDs have the same blocks
+int edidCompare(uint8_t edid1[ATEN_MAX_EDID_SIZE], uint8_t edid2[ATEN_MAX_EDID_SIZE])
+{
+    int blockCount = 1 + edid1[ATEN_EXTENSION_COUNT_OFFSET];
+
+    if (edid1[ATEN_EXTENSION_COUNT_OFFSET] != edid2[ATEN_EXTENSION_COUNT_OFFSET])
+        return 1;
+
+    return memcmp(edid1, edid2, blockCount * ATEN_BLOCK_SIZE) == 0 ? 0 : 1;
+}
+
+
+
+const char * edidErrorString(edid_error_t error)
+{
+    switch (error)
+    {
+    case EDID_OK:                   return "no error";
+    case EDID_TRUNCATED:            return "truncated";
+    case EDID_BAD_HEADER:           return "bad header";
+    case EDID_BAD_VERSION:          return "unsupported EDID version";
+    case EDID_BAD_MANUFACTURER:     return "bad manufacturer ID";
+    case EDID_BAD_CHECKSUM:         return "bad checksum";
+    case EDID_BAD_CTA:              return "malformed CTA-861 extension";
+    case EDID_BAD_DISPLAYID:        return "malformed DisplayID extension";
+    case EDID_UNKNOWN_EXTENSION:    return "unknown extension";
+    default:                        return "unknown error";
+    }
+}
+
+
+
+void edidDescribeIssue(const edid_issue_t * issue, char * text, size_t textSize)
+{
+    switch (issue->error)
+    {
+    case EDID_TRUNCATED:
+        snprintf(text, textSize, "truncated at offset 0x%02zx", issue->offset);
+        break;
+    case EDID_BAD_CHECKSUM:
+        snprintf(text, textSize, "At EDID offset 0x%02zx, found checksum 0x%02x, expected 0x%02x.", issue->offset, issue->found, issue->expected);
+        break;
+    case EDID_UNKNOWN_EXTENSION:
+        snprintf(text, textSize, "block %d: unknown extension tag 0x%02x", issue->block, issue->found);
+        break;
+    default:
+        snprintf(text, textSize, "block %d, offset 0x%02zx: %s, found 0x%02x", issue->block, issue->offset, edidErrorString(issue->error), issue->found);
+        break;
+    }
+}
@@ -0,0 +1,105 @@
+//
+//  edid.h
+//  atenvc080
+//
+
+// EDID validation and decoding: base block, CTA-861 and DisplayID extensions, up to ATEN_MAX_EXTENSION_COUNT
+// extension blocks. Nothing is printed, problems are returned as issues for the caller to report.
+
+#ifndef edid_h
+#define edid_h
+
+#include "aten.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+#define EDID_MAX_ISSUES                 16
+
+#define EDID_TAG_CTA                    0x02
+#define EDID_TAG_VTB                    0x10
+#define EDID_TAG_DI                     0x40
+#define EDID_TAG_LS                     0x50
+#define EDID_TAG_DPVL                   0x60
+#define EDID_TAG_DISPLAYID              0x70
+#define EDID_TAG_BLOCK_MAP              0xf0
+#define EDID_TAG_MANUFACTURER           0xff
+
+
+
+typedef enum
+{
+    EDID_OK = 0,
+    EDID_TRUNCATED,                 // fewer bytes than the announced blocks
+    EDID_BAD_HEADER,
+    EDID_BAD_VERSION,
+    EDID_BAD_MANUFACTURER,
+    EDID_BAD_CHECKSUM,              // found is the checksum byte, expected the value that makes the block sum 0
+    EDID_BAD_CTA,                   // malformed CTA-861 extension, e.g. a data block beyond the DTD offset
+    EDID_BAD_DISPLAYID,             // malformed DisplayID section, or bad section checksum
+    EDID_UNKNOWN_EXTENSION,         // extension tag not known, not an error by itself
+} edid_error_t;
+
+typedef struct
+{
+    edid_error_t error;
+    int block;                      // 0 for the base block
+    size_t offset;                  // in the whole EDID
+    uint8_t found;
+    uint8_t expected;
+} edid_issue_t;
+
+typedef struct
+{
+    int blockCount;
+
+    // base block
+    char manufacturer[4];           // 3 letters PNP ID
+    uint16_t product;
+    uint32_t serialNumber;
+    int week;
+    int year;
+    int version;
+    int revision;
+    char name[14];                  // monitor name descriptor, empty if none
+    char serialText[14];            // serial number descriptor, empty if none
+
+    // extensions
+    int ctaCount;
+    int ctaRevision;                // of the first CTA-861 extension
+    int ctaDataBlockCount;          // of all CTA-861 extensions
+    int ctaDetailedTimingCount;
+    int hdmi;                       // an HDMI vendor-specific data block was found
+    int displayIDCount;
+    int displayIDVersion;           // of the first DisplayID extension, e.g. 0x12 or 0x20
+    int displayIDDataBlockCount;
+
+    size_t errorCount;              // issues other than EDID_UNKNOWN_EXTENSION
+    size_t issueCount;              // may exceed EDID_MAX_ISSUES, only the first ones are kept
+    edid_issue_t issues[EDID_MAX_ISSUES];
+} edid_info_t;
+
+
+
+uint8_t edidBlockSum(const uint8_t block[ATEN_BLOCK_SIZE]);          // 0 for a valid block
+int edidVerifyChecksum(uint8_t edid[ATEN_MAX_EDID_SIZE]);
+int edidIsValid(uint8_t edid[ATEN_MAX_EDID_SIZE]);
+int edidValidate(const uint8_t * edid, size_t byteCount, edid_info_t * info);     // ATEN_INVALID if any error issue
+int edidCompare(uint8_t edid1[ATEN_MAX_EDID_SIZE], uint8_t edid2[ATEN_MAX_EDID_SIZE]);
+uint64_t edidDigestBytes(const uint8_t * bytes, size_t byteCount);
+uint64_t edidDigest(uint8_t edid[ATEN_MAX_EDID_SIZE]);
+
+const char * edidErrorString(edid_error_t error);
+void edidDescribeIssue(const edid_issue_t * issue, char * text, size_t textSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* edid_h */
@@ -0,0 +1,707 @@
+//
+//  engine.c
+//  atenvc080
+//
+
+#include "engine.h"
+#include "edid.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+
+#define ENGINE_FIRMWARE_PAUSE   100         // after the rate of the serial port changed, as atenUpdateFirmware()
+
+
+
+// steps of engineUpdateFirmware(), named after the frame whose reply is awaited
+enum
+{
+    engineFirmwareRateChanged = 0,
+    engineFirmwareEN,
+    engineFirmware80,
+    engineFirmwareDI,
+    engineFirmwareCT,
+    engineFirmwareA2,
+    engineFirmwareA3,
+    engineFirmwareDT,
+    engineFirmwareAD,
+    engineFirmwareRateRestored,
+};
+
+
+
+static void engineAwait(engine_port_t * port, engine_wait_t wait, uintmax_t milliseconds)
+{
+    port->wait = wait;
+    port->deadline = monotonicMilliseconds() + milliseconds;
+}
+
+
+
+static void engineAwaitBytes(engine_port_t * port, uint8_t * input, size_t byteCount, uintmax_t milliseconds)
+{
+    port->input = input;
+    port->inputCount = byteCount;
+    port->inputReceived = 0;
+    engineAwait(port, engineAwaitingBytes, milliseconds);
+}
+
+
+
+static void engineFinish(engine_port_t * port, int status)
+{
+    traceEvent("engine", port->operation, port->start, "status", status);
+
+    port->status = status;
+    port->operation = NULL;
+    port->wait = engineIdle;
+
+    if (port->done != NULL)
+        port->done(port, port->context);
+}
+
+
+
+static void engineResume(engine_port_t * port, int status)
+{
+    port->wait = engineIdle;
+    port->resume(port, status);
+}
+
+
+
+// Send a command byte and start waiting for its outcome.
+static int engineStart(engine_port_t * port, const char * operation, uint8_t command, engineStepFunction_t resume, engine_wait_t wait, uintmax_t milliseconds)
+{
+    uintmax_t start = traceTime();
+
+
+    if (enginePortBusy(port))
+        return ATEN_WRITE_ERROR;
+
+    if (serialWriteByte(port->serialDevice, command) != serialOK)
+    {
+        traceEvent("engine", operation, start, "status", ATEN_WRITE_ERROR);
+        return ATEN_WRITE_ERROR;
+    }
+
+    port->operation = operation;
+    port->start = start;
+    port->resume = resume;
+    port->step = 0;
+    port->command = command;
+    engineAwait(port, wait, milliseconds);
+
+    return ATEN_NO_ERROR;
+}
+
+
+
+// Start an acknowledged operation, waiting for the first attempt of its policy.
+static int engineStartAttempts(engine_port_t * port, const char * operation, uint8_t command, engineStepFunction_t resume, aten_policy_class_t policyClass)
+{
+    uintmax_t now = monotonicMilliseconds();
+    uintmax_t wait = atenPolicyWait(policyClass, 0, now);
+    int status;
+
+
+    if ((status = engineStart(port, operation, command, resume, engineAwaitingAck, wait)) != ATEN_NO_ERROR)
+        return status;
+
+    port->policyClass = policyClass;
+    port->attempt = 0;
+    port->attemptsStart = now;
+
+    return ATEN_NO_ERROR;
+}
+
+
+
+// Send the command again, if its acknowledgement timed out and its policy allows it.
+// Returns 0 if the operation has to finish with status.
+static int engineRetry(engine_port_t * port, int status)
+{
+    uintmax_t wait;
+
+
+    if (status != ATEN_TIMEOUT || port->step != 0)
+        return 0;
+    if ((wait = atenPolicyWait(port->policyClass, ++port->attempt, port->attemptsStart)) == 0)
+        return 0;
+
+    serialClearPendingBytes(port->serialDevice);    // what is left of the previous attempt, dismiss errors
+    if (serialWriteByte(port->serialDevice, port->command) != serialOK)
+        return 0;
+
+    engineAwait(port, engineAwaitingAck, wait);
+
+    return 1;
+}
+
+
+
+static void engineStepSettled(engine_port_t * port, int status)
+{
+    engineFinish(port, status);                // ATEN_NO_ERROR whether the device replied or not, unless it hung up
+}
+
+
+
+static void engineStepIdentify(engine_port_t * port, int status)
+{
+    port->deviceType = (status == ATEN_NO_ERROR) ? port->reply[0] : -1;
+    engineFinish(port, status);
+}
+
+
+
+// step 0: the command was acknowledged, then each block is read
+static void engineStepReadEDID(engine_port_t * port, int status)
+{
+    uint8_t fetch = 0x05;
+
+
+    if (status != ATEN_NO_ERROR)
+    {
+        if (!engineRetry(port, status))
+            engineFinish(port, status);
+        return;
+    }
+
+    switch (port->step++)
+    {
+    case 0:
+        engineAwaitBytes(port, port->edid, ATEN_BLOCK_SIZE, ATEN_BLOCK_TIMEOUT);
+        return;
+    case 1:
+        port->extension = 0;
+        break;
+    default:
+        port->extension++;
+        break;
+    }
+
+    if (port->extension == port->edid[ATEN_EXTENSION_COUNT_OFFSET])
+    {
+        engineFinish(port, edidIsValid(port->edid));
+        return;
+    }
+
+    if (serialWriteByte(port->serialDevice, fetch) != serialOK)
+    {
+        engineFinish(port, ATEN_READ_ERROR);
+        return;
+    }
+    engineAwaitBytes(port, port->edid + (port->extension + 1) * ATEN_BLOCK_SIZE, ATEN_BLOCK_SIZE, ATEN_BLOCK_TIMEOUT);
+}
+
+
+
+// step 0: the command was acknowledged, then each block is sent once the previous one was
+static void engineStepWriteEDID(engine_port_t * port, int status)
+{
+    int block;
+
+
+    if (status != ATEN_NO_ERROR)
+    {
+        if (!engineRetry(port, status))
+            engineFinish(port, status);
+        return;
+    }
+
+    block = port->step++;
+
+    if (block > port->edid[ATEN_EXTENSION_COUNT_OFFSET])
+    {
+        engineFinish(port, ATEN_NO_ERROR);
+        return;
+    }
+
+    if (serialWriteBytes(port->serialDevice, port->edid + block * ATEN_BLOCK_SIZE, ATEN_BLOCK_SIZE) != serialOK)
+    {
+        engineFinish(port, ATEN_WRITE_ERROR);
+        return;
+    }
+    engineAwait(port, engineAwaitingAck, atenGetPolicy(ATEN_POLICY_WRITE)->wait);
+}
+
+
+
+void enginePortInit(engine_port_t * port, serial_t serialDevice, engineDoneFunction_t done, void * context)
+{
+    bzero(port, sizeof(engine_port_t));
+    port->serialDevice = serialDevice;
+    port->done = done;
+    port->context = context;
+    port->status = ATEN_NO_ERROR;
+    port->deviceType = -1;
+}
+
+
+
+int engineIdentify(engine_port_t * port)
+{
+    return engineStart(port, "engineIdentify", 0x0b, engineStepIdentify, engineAwaitingReply, ATEN_REPLY_TIMEOUT);
+}
+
+
+
+int engineSelectSet(engine_port_t * port, aten_set_id setID)
+{
+    switch (setID)
+    {
+    case ATEN_SET_DEFAULT: return engineStart(port, "engineSelectSet", 0x01, engineStepSettled, engineSettling, atenGetPolicy(ATEN_POLICY_SWITCH)->wait);
+    case ATEN_SET_1:       return engineStart(port, "engineSelectSet", 0x02, engineStepSettled, engineSettling, atenGetPolicy(ATEN_POLICY_SWITCH)->wait);
+    case ATEN_SET_2:       return engineStart(port, "engineSelectSet", 0x03, engineStepSettled, engineSettling, atenGetPolicy(ATEN_POLICY_SWITCH)->wait);
+    case ATEN_SET_3:       return engineStart(port, "engineSelectSet", 0x04, engineStepSettled, engineSettling, atenGetPolicy(ATEN_POLICY_SWITCH)->wait);
+    default:               return ATEN_WRITE_ERROR;
+    }
+}
+
+
+
+int engineReadSet(engine_port_t * port, uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    if (enginePortBusy(port))
+        return ATEN_WRITE_ERROR;
+
+    port->edid = edid;
+    bzero(edid, 2 * ATEN_BLOCK_SIZE);
+
+    return engineStartAttempts(port, "engineReadSet", 0x0c, engineStepReadEDID, ATEN_POLICY_READ);
+}
+
+
+
+int engineReadDisplay(engine_port_t * port, uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    if (enginePortBusy(port))
+        return ATEN_WRITE_ERROR;
+
+    port->edid = edid;
+    bzero(edid, 2 * ATEN_BLOCK_SIZE);
+
+    return engineStartAttempts(port, "engineReadDisplay", 0x07, engineStepReadEDID, ATEN_POLICY_DISPLAY);
+}
+
+
+
+int engineWriteEDID(engine_port_t * port, uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    if (enginePortBusy(port) || edid[ATEN_EXTENSION_COUNT_OFFSET] > 1)
+        return ATEN_WRITE_ERROR;
+
+    port->edid = edid;
+
+    return engineStartAttempts(port, "engineWriteEDID", 0x0a, engineStepWriteEDID, ATEN_POLICY_WRITE);
+}
+
+
+
+int engineCECConnect(engine_port_t * port)
+{
+    return engineStart(port, "engineCECConnect", 0x08, engineStepSettled, engineSettling, atenGetPolicy(ATEN_POLICY_SWITCH)->wait);
+}
+
+
+
+int engineCECDisconnect(engine_port_t * port)
+{
+    return engineStart(port, "engineCECDisconnect", 0x09, engineStepSettled, engineSettling, atenGetPolicy(ATEN_POLICY_SWITCH)->wait);
+}
+
+
+
+// header followed by data, then the checksum
+static int engineSendFrame(engine_port_t * port, const uint8_t * header, size_t headerCount, const uint8_t * data, size_t dataCount)
+{
+    size_t byteCount = headerCount + dataCount + 1;
+
+
+    memcpy(port->frame, header, headerCount);
+    if (dataCount > 0)
+        memcpy(port->frame + headerCount, data, dataCount);
+    atenAppendFirmwareModeChecksum(port->frame, byteCount);
+    port->frameCount = byteCount;
+    port->attempt = 0;
+    port->attemptsStart = monotonicMilliseconds();
+
+    return serialWriteBytes(port->serialDevice, port->frame, byteCount) == serialOK ? ATEN_NO_ERROR : ATEN_WRITE_ERROR;
+}
+
+
+
+// first attempt of the frame just sent
+static void engineAwaitFrameReply(engine_port_t * port, size_t byteCount)
+{
+    engineAwaitBytes(port, port->reply, byteCount, atenPolicyWait(ATEN_POLICY_FIRMWARE, 0, port->attemptsStart));
+}
+
+
+
+// Send the frame again, if its reply timed out and the firmware policy allows it.
+// Returns 0 if the update has to end.
+static int engineResendFrame(engine_port_t * port, int status)
+{
+    uintmax_t wait;
+
+
+    if (status != ATEN_TIMEOUT || port->step == engineFirmwareRateChanged || port->step == engineFirmwareEN)
+        return 0;
+    if ((wait = atenPolicyWait(ATEN_POLICY_FIRMWARE, ++port->attempt, port->attemptsStart)) == 0)
+        return 0;
+
+    serialClearPendingBytes(port->serialDevice);    // what is left of the previous attempt, dismiss errors
+    if (serialWriteBytes(port->serialDevice, port->frame, port->frameCount) != serialOK)
+        return 0;
+
+    engineAwaitBytes(port, port->reply, port->inputCount, wait);
+
+    return 1;
+}
+
+
+
+static int engineValidReply(engine_port_t * port, size_t byteCount)
+{
+    return port->reply[0] == 'F' && port->reply[1] == 'U' && atenVerifyFirmwareModeChecksum(port->reply, byteCount) == ATEN_NO_ERROR;
+}
+
+
+
+// The serial port is given back its rate, whatever the outcome.
+static void engineEndFirmwareUpdate(engine_port_t * port, int status)
+{
+    port->firmwareStatus = status;
+    serialSetRate(port->serialDevice, 115200, 115200);     // dismiss errors
+    serialSetRTS(port->serialDevice, 0);                    // dismiss errors
+    port->step = engineFirmwareRateRestored;
+    engineAwait(port, enginePausing, ENGINE_FIRMWARE_PAUSE);
+}
+
+
+
+// Next data frame, or the end of data.
+static void engineSendFirmwareData(engine_port_t * port)
+{
+    uint8_t headerA3[6] = { 'F', 'U', 0xa3, 0x00, (port->offset / 64) >> 8, port->offset / 64 };
+    static const uint8_t headerDT[6] = { 'F', 'U', 0xa4, 0x00, 'D', 'T' };
+
+
+    if (port->offset == ATEN_FIRMWARE_SIZE_2)
+    {
+        if (engineSendFrame(port, headerDT, sizeof(headerDT), NULL, 0) != ATEN_NO_ERROR)
+            goto writeError;
+        port->step = engineFirmwareDT;
+        engineAwaitFrameReply(port, 6);
+        return;
+    }
+
+    port->frameStart = monotonicMilliseconds();
+    if (engineSendFrame(port, headerA3, sizeof(headerA3), port->firmware + ATEN_FIRMWARE_SIZE_1 + port->offset, 64) != ATEN_NO_ERROR)
+        goto writeError;
+    port->step = engineFirmwareA3;
+    engineAwaitFrameReply(port, 8);
+    return;
+
+writeError:
+    engineEndFirmwareUpdate(port, ATEN_WRITE_ERROR);
+}
+
+
+
+// Each case checks the reply to the frame sent by the previous one, as atenUpdateFirmware() does, and sends the next frame.
+static void engineStepFirmware(engine_port_t * port, int status)
+{
+    static const uint8_t zeros[24] = { 0 };
+    static const uint8_t headerEN[5] = { 'F', 'U', 0xff, 'E', 'N' };
+    static const uint8_t header80[3] = { 'F', 'U', 0x80 };
+    static const uint8_t headerDI[6] = { 'F', 'U', 0x90, 0x00, 'D', 'I' };
+    static const uint8_t headerCT[6] = { 'F', 'U', 0xa0, 0x00, 'C', 'T' };
+    static const uint8_t headerA2[4] = { 'F', 'U', 0xa2, 0x00 };
+    static const uint8_t headerAD[6] = { 'F', 'U', 0xa5, 0xff, 'A', 'D' };
+    const uint8_t * reply = port->reply;
+
+
+    if (port->step == engineFirmwareRateRestored)
+    {
+        engineFinish(port, port->firmwareStatus);
+        return;
+    }
+
+    if (status != ATEN_NO_ERROR)
+    {
+        if (!engineResendFrame(port, status))
+            engineEndFirmwareUpdate(port, status);
+        return;
+    }
+
+    switch (port->step)
+    {
+    case engineFirmwareRateChanged:
+        if (engineSendFrame(port, headerEN, sizeof(headerEN), NULL, 0) != ATEN_NO_ERROR)
+            goto writeError;
+        port->step = engineFirmwareEN;
+        engineAwaitBytes(port, port->reply, 32, ATEN_REPLY_TIMEOUT + ATEN_BLOCK_TIMEOUT);
+        return;
+
+    case engineFirmwareEN:
+        if (!engineValidReply(port, 32) || reply[2] != (headerEN[2] ^ 0x80))
+            goto readError;
+        if (engineSendFrame(port, header80, sizeof(header80), zeros, sizeof(zeros)) != ATEN_NO_ERROR)
+            goto writeError;
+        port->step = engineFirmware80;
+        engineAwaitFrameReply(port, 5);
+        return;
+
+    case engineFirmware80:
+        if (!engineValidReply(port, 5) || reply[2] != (header80[2] ^ 0x80) || reply[3] != 0x00)
+            goto writeError;
+        if (engineSendFrame(port, headerDI, sizeof(headerDI), NULL, 0) != ATEN_NO_ERROR)
+            goto writeError;
+        port->step = engineFirmwareDI;
+        engineAwaitFrameReply(port, 50);
+        return;
+
+    case engineFirmwareDI:
+        if (!engineValidReply(port, 50))
+            goto writeError;
+        if (reply[2] != (headerDI[2] ^ 0x80) || reply[3] != headerDI[3] || memcmp(reply + 4, "VC060/080", 9))
+            goto readError;
+        memcpy(port->progress->deviceIdentity, reply + 4, ATEN_FIRMWARE_IDENTITY_SIZE);
+        if (engineSendFrame(port, headerCT, sizeof(headerCT), NULL, 0) != ATEN_NO_ERROR)
+            goto writeError;
+        port->step = engineFirmwareCT;
+        engineAwaitFrameReply(port, 6);
+        return;
+
+    case engineFirmwareCT:
+        if (!engineValidReply(port, 6) || reply[2] != (headerCT[2] ^ 0x80) || reply[3] != headerCT[3] || reply[4] != 0x00)
+            goto writeError;
+        port->progress->start = monotonicMilliseconds();
+        port->frameStart = port->progress->start;
+        if (engineSendFrame(port, headerA2, sizeof(headerA2), port->firmware, ATEN_FIRMWARE_SIZE_1) != ATEN_NO_ERROR)
+            goto writeError;
+        port->step = engineFirmwareA2;
+        engineAwaitFrameReply(port, 6);
+        return;
+
+    case engineFirmwareA2:
+        if (!engineValidReply(port, 6) || reply[2] != (headerA2[2] ^ 0x80) || reply[3] != headerA2[3] || reply[4] != 0x00)
+            goto writeError;
+        atenFirmwareFrameDone(port->progress, port->frameStart, ATEN_FIRMWARE_SIZE_1, port->progressFunction, port->progressContext);
+        port->offset = 0;
+        engineSendFirmwareData(port);
+        return;
+
+    case engineFirmwareA3:
+        if (!engineValidReply(port, 8) || reply[2] != (port->frame[2] ^ 0x80) || reply[3] != port->frame[3] ||
+            reply[4] != port->frame[4] || reply[5] != port->frame[5] || reply[6] != 0x00)
+            goto writeError;
+        atenFirmwareFrameDone(port->progress, port->frameStart, 64, port->progressFunction, port->progressContext);
+        port->offset += 64;
+        engineSendFirmwareData(port);
+        return;
+
+    case engineFirmwareDT:
+        if (!engineValidReply(port, 6) || reply[2] != (0xa4 ^ 0x80) || reply[3] != 0x00 || reply[4] != 0x00)
+            goto writeError;
+        if (engineSendFrame(port, headerAD, sizeof(headerAD), NULL, 0) != ATEN_NO_ERROR)
+            goto writeError;
+        port->step = engineFirmwareAD;
+        engineAwaitFrameReply(port, 6);
+        return;
+
+    case engineFirmwareAD:
+        if (!engineValidReply(port, 6) || reply[2] != (headerAD[2] ^ 0x80) || reply[3] != 0x00 || reply[4] != 0x00)
+            goto writeError;
+        engineEndFirmwareUpdate(port, ATEN_NO_ERROR);
+        return;
+    }
+
+readError:
+    engineEndFirmwareUpdate(port, ATEN_READ_ERROR);
+    return;
+
+writeError:
+    engineEndFirmwareUpdate(port, ATEN_WRITE_ERROR);
+}
+
+
+
+// Unlike atenUpdateFirmware(), the state of the device is not printed.
+int engineUpdateFirmware(engine_port_t * port, const uint8_t * data, size_t length, aten_firmware_progress_t * progress, atenProgressFunction_t progressFunction, void * context)
+{
+    if (enginePortBusy(port))
+        return ATEN_WRITE_ERROR;
+
+    if (atenVerifyFirmware(data, length) != ATEN_NO_ERROR)
+        return ATEN_INVALID;
+
+    if (serialSetRate(port->serialDevice, 19200, 19200) != serialOK || serialSetRTS(port->serialDevice, 0) != serialOK)
+    {
+        serialSetRate(port->serialDevice, 115200, 115200);     // dismiss errors
+        return ATEN_WRITE_ERROR;
+    }
+
+    port->firmware = data;
+    port->progress = (progress != NULL) ? progress : &port->localProgress;
+    bzero(port->progress, sizeof(aten_firmware_progress_t));
+    port->progress->totalByteCount = ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2;
+    port->progressFunction = progressFunction;
+    port->progressContext = context;
+
+    port->operation = "engineUpdateFirmware";
+    port->start = traceTime();
+    port->resume = engineStepFirmware;
+    port->step = engineFirmwareRateChanged;
+    engineAwait(port, enginePausing, ENGINE_FIRMWARE_PAUSE);       // pending input is dismissed meanwhile
+
+    return ATEN_NO_ERROR;
+}
+
+
+
+int enginePortBusy(const engine_port_t * port)
+{
+    return port->operation != NULL;
+}
+
+
+
+// input is read while busy, if only to be dismissed
+int engineWantsInput(const engine_port_t * port)
+{
+    return enginePortBusy(port);
+}
+
+
+
+uintmax_t engineDeadline(const engine_port_t * port)
+{
+    return enginePortBusy(port) ? port->deadline : UINTMAX_MAX;
+}
+
+
+
+// Bytes are handled one by one: the outcome of a wait may start another one, for the bytes that follow.
+// A device readable without bytes hung up, its wait ends with ATEN_READ_ERROR rather than at the deadline.
+void engineInput(engine_port_t * port)
+{
+    uint8_t bytes[256];
+    size_t byteCount;
+
+
+    byteCount = serialReadPendingBytes(port->serialDevice, bytes, sizeof(bytes));
+    if (byteCount == 0 && port->wait != engineIdle && serialWaitForAvailableBytes(port->serialDevice, 0) == serialError)
+    {
+        engineResume(port, ATEN_READ_ERROR);
+        return;
+    }
+    for (size_t i = 0; i < byteCount; i++)
+    {
+        switch (port->wait)
+        {
+        case engineAwaitingAck:
+            if (bytes[i] == 0x05)
+                engineResume(port, ATEN_NO_ERROR);
+            break;
+
+        case engineAwaitingBytes:
+            port->input[port->inputReceived++] = bytes[i];
+            if (port->inputReceived == port->inputCount)
+                engineResume(port, ATEN_NO_ERROR);
+            break;
+
+        case engineAwaitingReply:
+            port->reply[0] = bytes[i];
+            engineResume(port, ATEN_NO_ERROR);
+            break;
+
+        case engineSettling:
+            engineResume(port, ATEN_NO_ERROR);
+            break;
+
+        case enginePausing:
+        case engineIdle:
+            break;
+        }
+    }
+}
+
+
+
+void engineTimer(engine_port_t * port, uintmax_t now)
+{
+    if (!enginePortBusy(port) || now < port->deadline)
+        return;
+
+    switch (port->wait)
+    {
+    case engineSettling:
+    case enginePausing:
+        engineResume(port, ATEN_NO_ERROR);
+        break;
+
+    case engineAwaitingAck:
+    case engineAwaitingBytes:
+    case engineAwaitingReply:
+        engineResume(port, ATEN_TIMEOUT);
+        break;
+
+    case engineIdle:
+        break;
+    }
+}
+
+
+
+void engineRun(engine_port_t ** ports, size_t portCount)
+{
+    serial_t * serialDevices;
+    int * available;
+
+
+    serialDevices = calloc(portCount, sizeof(serial_t));
+    available = calloc(portCount, sizeof(int));
+    if (serialDevices == NULL || available == NULL)
+        goto end;
+
+    for (;;)
+    {
+        uintmax_t now = monotonicMilliseconds();
+        uintmax_t nextDeadline = UINTMAX_MAX;
+        size_t busyCount = 0;
+
+
+        for (size_t i = 0; i < portCount; i++)
+        {
+            serialDevices[i] = engineWantsInput(ports[i]) ? ports[i]->serialDevice : serialClosed;
+            if (!enginePortBusy(ports[i]))
+                continue;
+            busyCount++;
+            if (engineDeadline(ports[i]) < nextDeadline)
+                nextDeadline = engineDeadline(ports[i]);
+        }
+        if (busyCount == 0)
+            break;
+
+        // input that came in time is handled before deadlines
+        serialWaitForAnyAvailableBytes(serialDevices, portCount, available, nextDeadline > now ? nextDeadline - now : 0);
+        for (size_t i = 0; i < portCount; i++)
+            if (available[i])
+                engineInput(ports[i]);
+
+        now = monotonicMilliseconds();
+        for (size_t i = 0; i < portCount; i++)
+            engineTimer(ports[i], now);
+    }
+
+end:
+    free(serialDevices);
+    free(available);
+}
@@ -0,0 +1,120 @@
+//
+//  engine.h
+//  atenvc080
+//
+
+// Non-blocking protocol engine: each operation of aten.h is a state machine of an engine_port_t, resumed when its
+// serial device has input or its deadline expired, so that a single thread drives as many devices as it opens.
+//
+// engineRun() is such an event loop, but any other, such as one built on epoll(7) or kqueue(2), may drive ports:
+//   - while enginePortBusy(), wait for input on the serial device when engineWantsInput(), and until engineDeadline()
+//   - call engineInput() when the serial device is readable, engineTimer() once the deadline has passed
+// Writes are not waited for, commands and frames are much smaller than the output buffer of a serial port.
+//
+// An operation is started by one of the engine functions taking the port. When it can't start, an ATEN_* error is
+// returned and nothing else happens. Otherwise, the done function of the port is called once it ends, with its
+// ATEN_* status in port->status, from engineInput() or engineTimer(), and never from the starting function.
+// The done function may start the next operation on the port.
+//
+// Waits and retries follow the policies of aten.h: a read command whose acknowledgement timed out is sent again, as
+// is a firmware frame whose reply timed out. Write commands get a single attempt.
+
+#ifndef engine_h
+#define engine_h
+
+#include "mac.h"
+#include "aten.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+typedef struct engine_port_s engine_port_t;
+
+typedef void (*engineDoneFunction_t)(engine_port_t * port, void * context);
+typedef void (*engineStepFunction_t)(engine_port_t * port, int status);
+
+typedef enum
+{
+    engineIdle = 0,
+    engineAwaitingAck,              // bytes are dismissed until 0x05
+    engineAwaitingBytes,            // inputCount bytes into input
+    engineAwaitingReply,            // a single byte, kept in reply[0]
+    engineSettling,                 // a single byte is dismissed, if any, or the deadline expires
+    enginePausing,                  // bytes are dismissed until the deadline
+} engine_wait_t;
+
+struct engine_port_s
+{
+    serial_t serialDevice;
+    engineDoneFunction_t done;
+    void * context;
+
+    int status;                     // of the last operation
+    int deviceType;                 // replied to engineIdentify(), -1 if none
+
+    // state of the current operation, NULL when idle
+    const char * operation;
+    engineStepFunction_t resume;    // called when the wait is over, with ATEN_TIMEOUT if the deadline expired
+    int step;
+    engine_wait_t wait;
+    uintmax_t deadline;
+    uint8_t * input;
+    size_t inputCount;
+    size_t inputReceived;
+    uintmax_t start;                // of the operation in the trace
+
+    // attempts of the operation, or of the firmware frame, under its policy
+    uint8_t command;
+    aten_policy_class_t policyClass;
+    unsigned attempt;
+    uintmax_t attemptsStart;
+
+    uint8_t * edid;
+    int extension;                  // being read or written
+
+    const uint8_t * firmware;
+    size_t offset;                  // of the next firmware data frame
+    int firmwareStatus;             // kept while the serial port is restored
+    aten_firmware_progress_t localProgress;
+    aten_firmware_progress_t * progress;
+    atenProgressFunction_t progressFunction;
+    void * progressContext;
+    uintmax_t frameStart;
+    size_t frameCount;              // bytes of the last frame sent
+
+    uint8_t frame[72];
+    uint8_t reply[64];
+};
+
+
+
+void enginePortInit(engine_port_t * port, serial_t serialDevice, engineDoneFunction_t done, void * context);
+
+int engineIdentify(engine_port_t * port);
+int engineSelectSet(engine_port_t * port, aten_set_id setID);
+int engineReadSet(engine_port_t * port, uint8_t edid[ATEN_MAX_EDID_SIZE]);
+int engineReadDisplay(engine_port_t * port, uint8_t edid[ATEN_MAX_EDID_SIZE]);
+int engineWriteEDID(engine_port_t * port, uint8_t edid[ATEN_MAX_EDID_SIZE]);
+int engineCECConnect(engine_port_t * port);
+int engineCECDisconnect(engine_port_t * port);
+int engineUpdateFirmware(engine_port_t * port, const uint8_t * data, size_t length, aten_firmware_progress_t * progress, atenProgressFunction_t progressFunction, void * context);
+
+int enginePortBusy(const engine_port_t * port);
+int engineWantsInput(const engine_port_t * port);
+uintmax_t engineDeadline(const engine_port_t * port);          // monotonic milliseconds
+void engineInput(engine_port_t * port);
+void engineTimer(engine_port_t * port, uintmax_t now);
+
+void engineRun(engine_port_t ** ports, size_t portCount);      // until no port is busy
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* engine_h */
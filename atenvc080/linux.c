@@ -0,0 +1,454 @@
+//
+//  linux.c
+//  atenvc080
+//
+
+// Linux specific functions, implementing the interface declared in mac.h
+
+#include "mac.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <linux/serial.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+
+
+// glibc's <termios.h> and the kernel's <asm/termbits.h> can't be included together,
+// but arbitrary baud rates are only available through the kernel's termios2.
+// This is the asm-generic layout, used by x86 and ARM.
+struct termios2
+{
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+
+#ifndef BOTHER
+#define BOTHER              0x00001000
+#endif
+#ifndef IBSHIFT
+#define IBSHIFT             16
+#endif
+
+
+
+serial_status_t serialOpenPort(serial_t * serialDevice, const char * path, struct termios * previousSettings)
+{
+    int handshake;
+    struct termios options;
+    struct serial_struct serialInfo;
+
+    *serialDevice = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (*serialDevice == -1)
+        goto error;
+
+    if (ioctl(*serialDevice, TIOCEXCL) == -1)
+        goto error;
+
+    if (fcntl(*serialDevice, F_SETFL, 0) == -1)
+        goto error;
+
+    if (previousSettings != NULL)
+    {
+        if (tcgetattr(*serialDevice, previousSettings) == -1)
+            goto error;
+    }
+
+    if (tcgetattr(*serialDevice, &options) == -1)
+        goto error;
+
+    cfmakeraw(&options);
+    // In noncanonical mode, if VMIN == 0 and VTIME == 0:
+    // - if data is available, read(2) returns immediately, with the lesser of the number of bytes available, or the number of bytes requested.
+    // - If no data is available, read(2) returns 0
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+
+    cfsetispeed(&options, B9600);               // Set default input speed
+    cfsetospeed(&options, B9600);               // Set default output speed
+    options.c_cflag |= CS8 | CLOCAL;            // Use 8 bit words, ignore modem control lines
+
+    if (tcsetattr(*serialDevice, TCSANOW, &options) == -1)
+        goto error;
+
+    // Have the driver push received bytes immediately instead of on its next tick.
+    // Not all drivers support it, so dismiss errors.
+    if (ioctl(*serialDevice, TIOCGSERIAL, &serialInfo) == 0)
+    {
+        serialInfo.flags |= ASYNC_LOW_LATENCY;
+        ioctl(*serialDevice, TIOCSSERIAL, &serialInfo);
+    }
+
+    // pseudo-terminals, such as the ones of atenvc080sim, have no modem control lines
+    handshake = TIOCM_DTR | TIOCM_RTS | TIOCM_CTS | TIOCM_DSR;
+    if (ioctl(*serialDevice, TIOCMSET, &handshake) == -1 && errno != ENOTTY)
+        goto error;
+
+    return serialOK;
+
+error:
+    if (*serialDevice != -1)
+        close(*serialDevice);
+
+    *serialDevice = -1;
+
+    return serialError;
+}
+
+
+
+serial_status_t serialClosePort(serial_t serialDevice, const struct termios * previousSettings)
+{
+    // Block until all written output has been sent from the device.
+    // Note that this call is simply passed on to the serial device driver.
+    // See tcsendbreak(3) <x-man-page://3/tcsendbreak> for details.
+    tcdrain(serialDevice);
+
+    // Traditionally it is good practice to reset a serial port back to
+    // the state in which you found it. This is why the original termios struct
+    // was saved.
+    if (previousSettings != NULL)
+        tcsetattr(serialDevice, TCSANOW, previousSettings);
+
+    close(serialDevice);
+
+    return serialOK;
+}
+
+
+
+serial_status_t serialSetRate(serial_t serialDevice, unsigned long inputRate, unsigned long outputRate)
+{
+    struct termios2 options;
+
+
+    if (ioctl(serialDevice, TCGETS2, &options) == -1)
+        return serialError;
+
+    options.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    options.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    options.c_ispeed = inputRate;
+    options.c_ospeed = outputRate;
+
+    if (ioctl(serialDevice, TCSETS2, &options) == -1)
+        return serialError;
+
+    return serialOK;
+}
+
+
+
+serial_status_t serialSetRTS(int serialDevice, int state)
+{
+    int handshake;
+
+    if (ioctl(serialDevice, TIOCMGET, &handshake) == -1)
+        return (errno == ENOTTY) ? serialOK : serialError;    // no modem control lines
+
+    if (state)
+        handshake |= TIOCM_RTS;
+    else
+        handshake &= ~TIOCM_RTS;
+
+    if (ioctl(serialDevice, TIOCMSET, &handshake) == -1)
+        return serialError;
+
+    return serialOK;
+}
+
+
+
+size_t serialPendingBytesCount(int serialDevice)
+{
+    int count;
+
+    
+    if (ioctl(serialDevice, FIONREAD, &count) == -1)
+        return 0;
+
+    if (count < 0)
+        return 0;
+
+    return count;
+}
+
+
+
+int serialReadByte(int serialDevice)
+{
+    uintmax_t start = traceTime();
+    uint8_t byte;
+    ssize_t byteCount;
+
+
+    if (serialPendingBytesCount(serialDevice) < 1)
+        return  -1;
+
+    byteCount = read(serialDevice, &byte, 1);
+    if (byteCount < 1)
+        return -1;
+
+    traceEvent("serial", "read", start, "bytes", 1);
+
+    return byte;
+}
+
+
+
+// Blocks until byteCount bytes are read, or until 'milliseconds' have elapsed.
+serial_status_t serialReadBytes(int serialDevice, uint8_t * bytes, size_t byteCount, uintmax_t milliseconds)
+{
+    uintmax_t start = traceTime();
+    uintmax_t deadline = monotonicMilliseconds() + milliseconds;
+    uintmax_t now;
+    size_t requestedCount = byteCount;
+    ssize_t readBytes;
+    serial_status_t status = serialOK;
+
+
+    while (byteCount > 0)
+    {
+        readBytes = read(serialDevice, bytes, byteCount);
+        if (readBytes > 0)
+        {
+            byteCount -= readBytes;
+            bytes += readBytes;
+            continue;
+        }
+        if (readBytes < 0 && errno != EINTR && errno != EAGAIN)
+        {
+            status = serialError;
+            break;
+        }
+
+        // VMIN == 0 and VTIME == 0: read(2) returned 0 as no data is available, wait for some
+        now = monotonicMilliseconds();
+        if (now >= deadline)
+        {
+            status = serialTimeout;
+            break;
+        }
+        if (serialWaitForAvailableBytes(serialDevice, deadline - now) == serialError)
+        {
+            status = serialError;
+            break;
+        }
+    }
+
+    traceEvent("serial", "read", start, "bytes", requestedCount - byteCount);
+
+    return status;
+}
+
+
+
+size_t serialReadPendingBytes(serial_t serialDevice, uint8_t * bytes, size_t maxByteCount)
+{
+    size_t byteCount = serialPendingBytesCount(serialDevice);
+
+    if (byteCount <= 0)
+        return 0;
+
+    if (byteCount > maxByteCount)
+        byteCount = maxByteCount;
+
+    if (serialReadBytes(serialDevice, bytes, byteCount, 0) != serialOK)      // bytes are pending, no need to wait
+        return 0;
+
+    return byteCount;
+}
+
+
+
+serial_status_t serialClearPendingBytes(serial_t serialDevice)
+{
+    uint8_t dummy[256];
+
+
+    while (serialPendingBytesCount(serialDevice))
+        if (serialReadPendingBytes(serialDevice, dummy, sizeof(dummy)) == 0)
+            return serialError;
+
+    return serialOK;
+}
+
+
+
+serial_status_t serialWriteByte(int serialDevice, uint8_t byte)
+{
+    uintmax_t start = traceTime();
+
+
+    if (write(serialDevice, &byte, 1) != 1)
+        return serialError;
+
+    traceEvent("serial", "write", start, "bytes", 1);
+
+    return serialOK;
+}
+
+
+
+serial_status_t serialWriteBytes(int serialDevice, uint8_t * bytes, size_t byteCount)
+{
+    uintmax_t start = traceTime();
+
+
+    if (write(serialDevice, bytes, byteCount) != byteCount)
+        return serialError;
+
+    traceEvent("serial", "write", start, "bytes", byteCount);
+
+    return serialOK;
+}
+
+
+
+// Bytes still pending are reported before a hangup.
+serial_status_t serialWaitForAvailableBytes(serial_t serialDevice, uintmax_t milliseconds)
+{
+    uintmax_t start = traceTime();
+    size_t availableCount;
+    struct pollfd pollDescriptor;
+    serial_status_t status = serialTimeout;
+
+
+    pollDescriptor.fd = serialDevice;
+    pollDescriptor.events = POLLIN;
+    pollDescriptor.revents = 0;
+    poll(&pollDescriptor, 1, milliseconds > INT_MAX ? INT_MAX : (int) milliseconds);    // ignore return status, revents tell
+
+    availableCount = serialPendingBytesCount(serialDevice);
+    if (availableCount > 0)
+        status = serialOK;
+    else if (pollDescriptor.revents & (POLLHUP | POLLERR | POLLNVAL))
+        status = serialError;
+    traceEvent("serial", "wait", start, "available", availableCount);
+
+    return status;
+}
+
+
+
+// Closed devices are skipped, available[i] is set when bytes are pending on serialDevices[i], or once it hung up.
+size_t serialWaitForAnyAvailableBytes(const serial_t * serialDevices, size_t deviceCount, int available[],
+                                      uintmax_t milliseconds)
+{
+    uintmax_t start = traceTime();
+    size_t availableCount = 0;
+    struct pollfd * pollDescriptors;
+
+
+    pollDescriptors = calloc(deviceCount, sizeof(struct pollfd));
+    if (pollDescriptors == NULL)
+        return 0;
+
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+        pollDescriptors[i].fd = serialDevices[i];       // poll(2) ignores negative descriptors
+        pollDescriptors[i].events = POLLIN;
+    }
+    poll(pollDescriptors, deviceCount, milliseconds > INT_MAX ? INT_MAX : (int) milliseconds);    // ignore return status
+
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+        available[i] = serialDevices[i] != serialClosed && (serialPendingBytesCount(serialDevices[i]) > 0
+                                                            || (pollDescriptors[i].revents & (POLLHUP | POLLERR | POLLNVAL)));
+        if (available[i])
+            availableCount++;
+    }
+    free(pollDescriptors);
+    traceEvent("serial", "wait", start, "available", availableCount);
+
+    return availableCount;
+}
+
+
+
+serial_status_t serialWatchOpen(serialWatch_t * watch, const char * directory)
+{
+    watch->directory = -1;
+    watch->descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->descriptor == -1)
+        return serialError;
+
+    // udev creates the node, then sets its owner and mode
+    if (inotify_add_watch(watch->descriptor, directory, IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO) == -1)
+    {
+        close(watch->descriptor);
+        watch->descriptor = -1;
+        return serialError;
+    }
+
+    return serialOK;
+}
+
+
+
+void serialWatchClear(serialWatch_t * watch)
+{
+    char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+
+    while (read(watch->descriptor, events, sizeof(events)) > 0)
+        ;
+}
+
+
+
+void serialWatchClose(serialWatch_t * watch)
+{
+    if (watch->descriptor != -1)
+        close(watch->descriptor);
+    watch->descriptor = -1;
+}
+
+
+
+void pauseMilliseconds(unsigned long milliSeconds)
+{
+    uintmax_t start = traceTime();
+    struct timespec requestedTime;
+    struct timespec remainingTime;
+    int sleepStatus;
+
+
+    requestedTime.tv_sec = milliSeconds / 1000;
+    requestedTime.tv_nsec = (milliSeconds % 1000) * 1000000;
+
+    sleepStatus = nanosleep(&requestedTime, &remainingTime);
+    while (sleepStatus != 0)
+    {
+        requestedTime = remainingTime;
+        sleepStatus = nanosleep(&requestedTime, &remainingTime);
+    }
+
+    traceEvent("timing", "pause", start, "milliseconds", milliSeconds);
+}
+
+
+
+uintmax_t monotonicMilliseconds(void)
+{
+    struct timespec now;
+
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uintmax_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
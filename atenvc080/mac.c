@@ -7,8 +7,10 @@
 // based on <https://developer.apple.com/library/archive/samplecode/SerialPortSample/Listings/SerialPortSample_SerialPortSample_c.html#//apple_ref/doc/uid/DTS10000454-SerialPortSample_SerialPortSample_c-DontLinkElementID_4>
 
 #include "mac.h"
+#include "trace.h"
 
 #include <stdio.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <termios.h>
@@ -16,6 +18,7 @@
 #include <IOKit/serial/ioss.h>
 #include <time.h>
 #include <sys/select.h>
+#include <sys/event.h>
 
 
 
@@ -57,8 +60,9 @@ serial_status_t serialOpenPort(serial_t * serialDevice, const char * path, struc
     if (tcsetattr(*serialDevice, TCSANOW, &options) == -1)
         goto error;
 
+    // pseudo-terminals, such as the ones of atenvc080sim, have no modem control lines
     handshake = TIOCM_DTR | TIOCM_RTS | TIOCM_CTS | TIOCM_DSR;
-    if (ioctl(*serialDevice, TIOCMSET, &handshake) == -1)
+    if (ioctl(*serialDevice, TIOCMSET, &handshake) == -1 && errno != ENOTTY)
         goto error;
 
     return serialOK;
@@ -127,7 +131,7 @@ serial_status_t serialSetRTS(int serialDevice, int state)
     int handshake;
 
     if (ioctl(serialDevice, TIOCMGET, &handshake) == -1)
-        return serialError;
+        return (errno == ENOTTY) ? serialOK : serialError;    // no modem control lines
 
     if (state)
         handshake |= TIOCM_RTS;
@@ -160,8 +164,9 @@ size_t serialPendingBytesCount(int serialDevice)
 
 int serialReadByte(int serialDevice)
 {
+    uintmax_t start = traceTime();
     uint8_t byte;
-    size_t byteCount;
+    ssize_t byteCount;
 
 
     if (serialPendingBytesCount(serialDevice) < 1)
@@ -171,14 +176,22 @@ int serialReadByte(int serialDevice)
     if (byteCount < 1)
         return -1;
 
+    traceEvent("serial", "read", start, "bytes", 1);
+
     return byte;
 }
 
 
 
-serial_status_t serialReadBytes(int serialDevice, uint8_t * bytes, size_t byteCount)
+// Blocks until byteCount bytes are read, or until 'milliseconds' have elapsed.
+serial_status_t serialReadBytes(int serialDevice, uint8_t * bytes, size_t byteCount, uintmax_t milliseconds)
 {
-    size_t readBytes;
+    uintmax_t start = traceTime();
+    uintmax_t deadline = monotonicMilliseconds() + milliseconds;
+    uintmax_t now;
+    size_t requestedCount = byteCount;
+    ssize_t readBytes;
+    serial_status_t status = serialOK;
 
 
     while (byteCount > 0)
@@ -188,10 +201,31 @@ serial_status_t serialReadBytes(int serialDevice, uint8_t * bytes, size_t byteCo
         {
             byteCount -= readBytes;
             bytes += readBytes;
+            continue;
+        }
+        if (readBytes < 0 && errno != EINTR && errno != EAGAIN)
+        {
+            status = serialError;
+            break;
+        }
+
+        // VMIN == 0 and VTIME == 0: read(2) returned 0 as no data is available, wait for some
+        now = monotonicMilliseconds();
+        if (now >= deadline)
+        {
+            status = serialTimeout;
+            break;
+        }
+        if (serialWaitForAvailableBytes(serialDevice, deadline - now) == serialError)
+        {
+            status = serialError;
+            break;
         }
     }
 
-    return serialOK;
+    traceEvent("serial", "read", start, "bytes", requestedCount - byteCount);
+
+    return status;
 }
 
 
@@ -206,7 +240,7 @@ size_t serialReadPendingBytes(serial_t serialDevice, uint8_t * bytes, size_t max
     if (byteCount > maxByteCount)
         byteCount = maxByteCount;
 
-    if (serialReadBytes(serialDevice, bytes, byteCount) != serialOK)
+    if (serialReadBytes(serialDevice, bytes, byteCount, 0) != serialOK)      // bytes are pending, no need to wait
         return 0;
 
     return byteCount;
@@ -220,7 +254,7 @@ serial_status_t serialClearPendingBytes(serial_t serialDevice)
 
 
     while (serialPendingBytesCount(serialDevice))
-        if (serialReadPendingBytes(serialDevice, dummy, sizeof(dummy)) != serialOK)
+        if (serialReadPendingBytes(serialDevice, dummy, sizeof(dummy)) == 0)
             return serialError;
 
     return serialOK;
@@ -230,9 +264,14 @@ serial_status_t serialClearPendingBytes(serial_t serialDevice)
 
 serial_status_t serialWriteByte(int serialDevice, uint8_t byte)
 {
+    uintmax_t start = traceTime();
+
+
     if (write(serialDevice, &byte, 1) != 1)
         return serialError;
 
+    traceEvent("serial", "write", start, "bytes", 1);
+
     return serialOK;
 }
 
@@ -240,33 +279,139 @@ serial_status_t serialWriteByte(int serialDevice, uint8_t byte)
 
 serial_status_t serialWriteBytes(int serialDevice, uint8_t * bytes, size_t byteCount)
 {
+    uintmax_t start = traceTime();
+
+
     if (write(serialDevice, bytes, byteCount) != byteCount)
         return serialError;
 
+    traceEvent("serial", "write", start, "bytes", byteCount);
+
     return serialOK;
 }
 
 
 
-size_t serialWaitForAvailableBytes(serial_t serialDevice, uintmax_t milliseconds)
+// Bytes still pending are reported before a hangup: a device readable without any byte pending hung up.
+serial_status_t serialWaitForAvailableBytes(serial_t serialDevice, uintmax_t milliseconds)
 {
+    uintmax_t start = traceTime();
+    size_t availableCount;
     fd_set set;
     struct timeval tv;
+    int readyCount;
+    serial_status_t status = serialTimeout;
 
 
     FD_ZERO(&set);
     FD_SET(serialDevice, &set);
     tv.tv_sec = milliseconds / 1000;
     tv.tv_usec = (milliseconds % 1000) * 1000;
-    select(serialDevice + 1, &set, NULL, NULL, &tv);    // ignore return status
+    readyCount = select(serialDevice + 1, &set, NULL, NULL, &tv);
 
-    return serialPendingBytesCount(serialDevice);
+    availableCount = serialPendingBytesCount(serialDevice);
+    if (availableCount > 0)
+        status = serialOK;
+    else if (readyCount > 0 && FD_ISSET(serialDevice, &set))
+        status = serialError;
+    traceEvent("serial", "wait", start, "available", availableCount);
+
+    return status;
+}
+
+
+
+// Closed devices are skipped, available[i] is set when bytes are pending on serialDevices[i], or once it hung up.
+size_t serialWaitForAnyAvailableBytes(const serial_t * serialDevices, size_t deviceCount, int available[],
+                                      uintmax_t milliseconds)
+{
+    uintmax_t start = traceTime();
+    size_t availableCount = 0;
+    int maxDevice = -1;
+    fd_set set;
+    struct timeval tv;
+    int readyCount;
+
+
+    FD_ZERO(&set);
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+        if (serialDevices[i] == serialClosed || serialDevices[i] >= FD_SETSIZE)
+            continue;
+        FD_SET(serialDevices[i], &set);
+        if (serialDevices[i] > maxDevice)
+            maxDevice = serialDevices[i];
+    }
+    tv.tv_sec = milliseconds / 1000;
+    tv.tv_usec = (milliseconds % 1000) * 1000;
+    readyCount = select(maxDevice + 1, &set, NULL, NULL, &tv);
+
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+        available[i] = serialDevices[i] != serialClosed && (serialPendingBytesCount(serialDevices[i]) > 0
+                                                            || (readyCount > 0 && serialDevices[i] < FD_SETSIZE && FD_ISSET(serialDevices[i], &set)));
+        if (available[i])
+            availableCount++;
+    }
+    traceEvent("serial", "wait", start, "available", availableCount);
+
+    return availableCount;
+}
+
+
+
+serial_status_t serialWatchOpen(serialWatch_t * watch, const char * directory)
+{
+    struct kevent change;
+
+
+    watch->descriptor = kqueue();
+    watch->directory = open(directory, O_RDONLY | O_EVTONLY);
+    if (watch->descriptor == -1 || watch->directory == -1)
+        goto error;
+
+    // the directory is written when an entry is added or removed
+    EV_SET(&change, watch->directory, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE, 0, NULL);
+    if (kevent(watch->descriptor, &change, 1, NULL, 0, NULL) == -1)
+        goto error;
+
+    return serialOK;
+
+error:
+    serialWatchClose(watch);
+
+    return serialError;
+}
+
+
+
+void serialWatchClear(serialWatch_t * watch)
+{
+    struct kevent events[16];
+    struct timespec noWait = { 0, 0 };
+
+
+    while (kevent(watch->descriptor, NULL, 0, events, 16, &noWait) > 0)
+        ;
+}
+
+
+
+void serialWatchClose(serialWatch_t * watch)
+{
+    if (watch->descriptor != -1)
+        close(watch->descriptor);
+    if (watch->directory != -1)
+        close(watch->directory);
+    watch->descriptor = -1;
+    watch->directory = -1;
 }
 
 
 
 void pauseMilliseconds(unsigned long milliSeconds)
 {
+    uintmax_t start = traceTime();
     struct timespec requestedTime;
     struct timespec remainingTime;
     int sleepStatus;
@@ -281,4 +426,18 @@ void pauseMilliseconds(unsigned long milliSeconds)
         requestedTime = remainingTime;
         sleepStatus = nanosleep(&requestedTime, &remainingTime);
     }
+
+    traceEvent("timing", "pause", start, "milliseconds", milliSeconds);
+}
+
+
+
+uintmax_t monotonicMilliseconds(void)
+{
+    struct timespec now;
+
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uintmax_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
 }
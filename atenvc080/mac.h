@@ -3,7 +3,7 @@
 //  atenvc080
 //
 
-// macOS specific functions
+// Serial port and timing functions, implemented by mac.c (macOS) and linux.c (Linux)
 
 #ifndef serial_h
 #define serial_h
@@ -12,6 +12,10 @@
 #include <stddef.h>
 #include <sys/termios.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 
 
 typedef int serial_t;
@@ -19,10 +23,18 @@ typedef int serial_t;
 
 typedef struct termios serialSettings_t;
 
+// Changes of the entries of a directory such as /dev, inotify(7) on Linux, kqueue(2) on macOS
+typedef struct
+{
+    int descriptor;                 // readable once the directory changed
+    int directory;                  // the watched directory, macOS only
+} serialWatch_t;
+
 typedef enum
 {
     serialOK = 0,
     serialError,
+    serialTimeout,
 } serial_status_t;
 
 
@@ -33,13 +45,24 @@ serial_status_t serialSetRate(serial_t serialDevice, unsigned long inputRate, un
 serial_status_t serialSetRTS(serial_t serialDevice, int state);
 size_t serialPendingBytesCount(serial_t serialDevice);
 int serialReadByte(serial_t serialDevice);              // returns -1 if no byte is available
-serial_status_t serialReadBytes(serial_t serialDevice, uint8_t * bytes, size_t byteCount);
+serial_status_t serialReadBytes(serial_t serialDevice, uint8_t * bytes, size_t byteCount, uintmax_t milliseconds);
 size_t serialReadPendingBytes(serial_t serialDevice, uint8_t * bytes, size_t maxByteCount);
 serial_status_t serialClearPendingBytes(serial_t serialDevice);
 serial_status_t serialWriteByte(serial_t serialDevice, uint8_t byte);
 serial_status_t serialWriteBytes(serial_t serialDevice, uint8_t * bytes, size_t byteCount);
-size_t serialWaitForAvailableBytes(serial_t serialDevice, uintmax_t milliseconds);
+serial_status_t serialWaitForAvailableBytes(serial_t serialDevice, uintmax_t milliseconds);    // serialError once hung up
+size_t serialWaitForAnyAvailableBytes(const serial_t * serialDevices, size_t deviceCount, int available[],
+                                      uintmax_t milliseconds);     // returns the count of devices with bytes available or hung up
+
+serial_status_t serialWatchOpen(serialWatch_t * watch, const char * directory);
+void serialWatchClear(serialWatch_t * watch);           // dismiss pending changes once descriptor is readable
+void serialWatchClose(serialWatch_t * watch);
 
 void pauseMilliseconds(unsigned long milliSeconds);
+uintmax_t monotonicMilliseconds(void);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* serial_h */
@@ -7,23 +7,123 @@
 
 #include "mac.h"
 #include "aten.h"
+#include "workers.h"
+#include "cache.h"
+#include "edid.h"
+#include "scan.h"
+#include "pack.h"
+#include "profile.h"
+#include "engine.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+
+
+#define OPTIONS "?B:CDF:H:K:L:M:R:S:T:a:b:d:il:m:nqr:s:t:v:w:"
+#define SCRIPT_COMMANDS "CDFKRSadilmnqrstvw"        // options of OPTIONS a -b script may hold
+#define SERVER_COMMANDS "CDqrsw"                    // and the ones a -L client may send, 'r' to the client only
+#define SERVER_TIMEOUT  30                          // seconds a -L client may take to send or receive a line
+
+
+
+typedef struct
+{
+    serial_t serialDevice;
+    serialSettings_t previousSettings;
+    char devicePath[PATH_MAX];
+    int currentPosition;
+    int skipIdentical;              // don't write an EDID the selected set already holds
+    long cacheMaxAge;               // seconds, CACHE_NO_MAX_AGE to always read the device
+    int verifyRetries;              // writes again after a failed verification, -1 to not verify
+    pack_t pack;                    // last pack written from, kept mapped
+} session_t;
+
+typedef struct
+{
+    int argc;
+    char * const * argv;
+    int firstOption;
+} optionsContext_t;
+
+// The journal of a firmware update is a single record, rewritten in place as data frames are acknowledged:
+// the digest of the image, the count of its 0xa3 data frames the device acknowledged, and the identity the device
+// replied to 0x90 DI, in hexadecimal.
+#define FIRMWARE_JOURNAL_FORMAT     "%016" PRIx64 " %5zu %s\n"
+#define FIRMWARE_JOURNAL_SIZE       (23 + 1 + 2 * ATEN_FIRMWARE_IDENTITY_SIZE)
+
+typedef struct
+{
+    int lastStep;                   // of the progress printed
+    int journal;                    // -1 if the update can't be journaled
+    uint64_t digest;                // of the firmware image
+    uint8_t deviceIdentity[ATEN_FIRMWARE_IDENTITY_SIZE];     // of the device being updated, as journaled
+} firmwareContext_t;
+
+typedef struct
+{
+    char sources[ATEN_SET_3 + 1][PATH_MAX];     // EDID source of SET 1-3, empty to leave the set alone
+    int cec;                                    // 1 to connect, 0 to disconnect, -1 to leave CEC alone
+    int activePosition;                         // set to finish on, ATEN_SET_DISPLAY for any
+} manifest_t;
 
 
 
 void usage(void);
-void connectToDevice(serial_t *serialDevice, char * path, struct termios * previousSettings);
-void checkSerialDevice(serial_t serialDevice);
-void printInquiry(serial_t serialDevice);
-void selectSet(serial_t serialDevice, int *currentPosition, char * name);
-void writeEDIDToDevice(serial_t serialDevice, int currentPosition, char * path);
-void writeEDIDToFile(serial_t serialDevice, int currentPosition, char * path);
-void firmwareUpdate(serial_t serialDevice, char * path);
+void initSession(session_t * session);
+int connectToDevice(session_t * session, char * path);
+void closeSession(session_t * session);
+int checkSerialDevice(session_t * session);
+const char * deviceTypeName(int type);
+int printInquiry(session_t * session);
+int openDevicePort(serial_t * serialDevice, const char * path, serialSettings_t * previousSettings);
+int discoverDevices(char * pattern);
+const char * setName(int position);
+int setPosition(const char * name, int * position);
+int selectSet(session_t * session, char * name);
+int CECConnect(session_t * session);
+int CECDisconnect(session_t * session);
+int readSet(session_t * session, uint8_t edid[ATEN_MAX_EDID_SIZE]);
+int setCacheMaxAge(session_t * session, char * seconds);
+void printEDIDIssues(const edid_info_t * info);
+int readEDIDSource(session_t * session, char * source, uint8_t edid[ATEN_MAX_EDID_SIZE]);
+int buildPack(char * argument);
+int setVerifyRetries(session_t * session, char * retries);
+int setPolicy(char * argument);
+int calibrate(session_t * session, char * samples);
+int verifySet(session_t * session, uint8_t edid[ATEN_MAX_EDID_SIZE]);
+int writeEDIDToDevice(session_t * session, char * path);
+int writeEDIDToFile(session_t * session, char * path);
+size_t readFirmwareJournal(session_t * session, firmwareContext_t * firmware);
+void writeFirmwareJournal(firmwareContext_t * firmware, size_t frameCount);
+void firmwareProgress(const aten_firmware_progress_t * progress, void * context);
+int firmwareUpdate(session_t * session, char * path, int resume);
+int runScriptFile(session_t * session, FILE * script, int served);
+int runScript(session_t * session, char * path);
+int readManifest(const char * path, manifest_t * manifest);
+int provisionManifest(session_t * session, char * path);
+int serveRequests(session_t * session, char * path);
+void printMonitorEvent(const char * event, uint8_t edid[ATEN_MAX_EDID_SIZE]);
+int monitorDisplay(session_t * session, char * interval);
+int runOption(session_t * session, int character, char * argument);
+void runOptions(int argc, char * const argv[], session_t * session);
+int collectLeadingOptions(int argc, char * const argv[], glob_t * devicePaths, char ** watchPattern);
+int runOnDevice(const char * path, void * context);
+int provisionDevice(const char * path, void * context);
 
 
 
@@ -31,14 +131,34 @@ void usage(void)
 {
     //               1         2         3         4         5         6         7         8
     //      12345678901234567890123456789012345678901234567890123456789012345678901234567890
-    printf("usage: atenvc080 -d serial [options]\n");
+    printf("usage: atenvc080 [-T path] -d serial [options]\n");
+    printf("       atenvc080 [-T path] -H pattern [options]\n");
     printf("\n");
+    printf("       -T path       record a timeline of serial I/O, waits, pauses and\n");
+    printf("                       device operations to a Chrome trace event file at\n");
+    printf("                       path, to be opened with Perfetto. When given, -T must\n");
+    printf("                       come before -d\n");
+    printf("       -H pattern    watch for serial devices matching pattern, such as\n");
+    printf("                       '/dev/ttyUSB*', until interrupted. Each device that\n");
+    printf("                       appears is identified, then the following options\n");
+    printf("                       are run on it, concurrently with other devices.\n");
+    printf("                       Devices already attached are left alone. Once\n");
+    printf("                       interrupted, devices being provisioned are finished\n");
     printf("       options: (options are executed from left to right)\n");
     printf("       -d device     mandatory option that must come first.\n");
     printf("                     'device' is the path to the device connected to\n");
     printf("                       ATEN VC080 RS232 port\n");
     printf("                     e.g. -d /dev/cu.usbserial-...\n");
+    printf("                     -d may be repeated, and 'device' may be a quoted\n");
+    printf("                       pattern such as '/dev/cu.usbserial-*'. When several\n");
+    printf("                       devices are given, the following options are run\n");
+    printf("                       on all of them concurrently, to the end even if\n");
+    printf("                       interrupted\n");
     printf("       -q            identify device type\n");
+    printf("       -l pattern    identify the device on every port matching pattern, such\n");
+    printf("                       as '/dev/ttyUSB*'. All ports are queried at once,\n");
+    printf("                       and discovery takes one reply timeout at most.\n");
+    printf("                       Needs no device\n");
     printf("       -s set        select and switch set\n");
     printf("                     set can be one of:\n");
     printf("                       DEFAULT  select and switch emulator to DEFAULT set\n");
@@ -49,318 +169,1765 @@ void usage(void)
     printf("                                connected display's EDID. Beware that KVM\n");
     printf("                                or similar switches may return a modified\n");
     printf("                                display EDID\n");
-    printf("       -r path       read selected set, write it to EDID file at path\n");
+    printf("       -r path       read selected set, write it to EDID file at path, or\n");
+    printf("                       print it in hexadecimal if path is '-'\n");
     printf("       -w path       read EDID file at path and write it to selected device set\n");
+    printf("                     path may also be pack:NAME, for the EDID named NAME in\n");
+    printf("                       a pack built with -B\n");
+    printf("       -i            following -w first read the selected set back, and skip\n");
+    printf("                       writing when it already holds the same EDID\n");
+    printf("       -v retries    following -w read the set back and compare it with the\n");
+    printf("                       EDID written, reporting differing blocks, and write\n");
+    printf("                       again up to 'retries' times until they match\n");
+    printf("       -t class:attempts[,wait[,backoff[,deadline]]]\n");
+    printf("                     policy of the waits for the device, for class switch,\n");
+    printf("                       read, display, write or firmware. Attempt n, from 0,\n");
+    printf("                       waits wait * backoff^n milliseconds, and a timed out\n");
+    printf("                       read or firmware frame is attempted again until\n");
+    printf("                       attempts are exhausted or 'deadline' milliseconds\n");
+    printf("                       passed, 0 for none. Writes take a single attempt,\n");
+    printf("                       and switches are not acknowledged: their wait is\n");
+    printf("                       the time given to settle. Omitted values are kept,\n");
+    printf("                       e.g. -t read:3,500,2\n");
+    printf("       -K samples    calibrate: time 'samples' times each command on the\n");
+    printf("                       device, and keep their percentiles in its latency\n");
+    printf("                       profile, used as waits from then on, and by the\n");
+    printf("                       following runs on the device path. The selected\n");
+    printf("                       set, SET 1-3, is written back with its own EDID,\n");
+    printf("                       and CEC is left disconnected\n");
+    printf("       -a seconds    following reads of sets may be served from the cache of\n");
+    printf("                       EDIDs read and written by atenvc080, when the cached\n");
+    printf("                       EDID is not older than 'seconds'\n");
+    printf("       -n            following reads of sets read the device, not the cache\n");
+    printf("       -m path       provision the device as described by the manifest at\n");
+    printf("                       path, whose lines are '1', '2' or '3' followed by an\n");
+    printf("                       EDID source as for -w, 'cec on' or 'cec off', and\n");
+    printf("                       'active' followed by the set to finish on. A plan\n");
+    printf("                       is printed first: sets the cache knows to hold their\n");
+    printf("                       EDID are skipped, and the others are written in the\n");
+    printf("                       order needing the fewest switches. The cache is kept\n");
+    printf("                       per device path: after swapping the device on the\n");
+    printf("                       path, use -n before -m so that every set is checked\n");
     printf("       -C            CEC connect\n");
     printf("       -D            CEC disconnect\n");
-    printf("       -F path       update device with firmware file at path\n");
+    printf("       -F path       update device with firmware file at path. Progress is\n");
+    printf("                       journaled next to the device's cache\n");
+    printf("       -R path       resume the update of the device with firmware file at\n");
+    printf("                       path, after the last data frame acknowledged before\n");
+    printf("                       it was interrupted. Starts over from the erase if\n");
+    printf("                       there is no such update, the device doesn't identify\n");
+    printf("                       as the one it was flashing, or it refuses to take up\n");
+    printf("                       where it stopped\n");
+    printf("       -B pack:directory\n");
+    printf("                     build a pack from the EDID files under directory.\n");
+    printf("                       Each EDID is named after its path under directory,\n");
+    printf("                       without a .bin suffix, and identical EDIDs are stored\n");
+    printf("                       once. Needs no device\n");
+    printf("       -S directory  validate every file under directory as an EDID, and\n");
+    printf("                       print an index of digest, block count, manufacturer,\n");
+    printf("                       product, serial, status and path, followed by\n");
+    printf("                       duplicated EDIDs. Needs no device. Fails if a file\n");
+    printf("                       is not a valid EDID\n");
+    printf("       -b path       run the commands of script at path, '-' for stdin.\n");
+    printf("                     Each line holds one of the options above with its\n");
+    printf("                       argument, e.g. 's 2' or '-w edid.bin'. Empty lines\n");
+    printf("                       and lines starting with '#' are ignored.\n");
+    printf("                     The serial device stays open for the whole script,\n");
+    printf("                       and a failed command does not stop the script\n");
+    printf("       -L path       serve requests on UNIX-domain socket at path, until\n");
+    printf("                       interrupted. Each connection sends commands as for\n");
+    printf("                       -b and receives their output. Connections are served\n");
+    printf("                       one after the other, on the open serial device.\n");
+    printf("                       Only -q, -s, -r -, -w, -C and -D are served, the\n");
+    printf("                       socket is accessible to its owner only, and a client\n");
+    printf("                       idle for %d s is disconnected\n", SERVER_TIMEOUT);
+    printf("       -M interval   monitor the connected display's EDID every 'interval'\n");
+    printf("                       seconds, until interrupted, printing an event when\n");
+    printf("                       it changes. Each poll reads the base block only, and\n");
+    printf("                       extensions are read when the base block changed\n");
     printf("       -?            print this help\n");
 }
 
 
 
-void checkSerialDevice(serial_t serialDevice)
+void initSession(session_t * session)
+{
+    session->serialDevice = serialClosed;
+    session->currentPosition = ATEN_SET_DISPLAY;
+    session->skipIdentical = 0;
+    session->cacheMaxAge = CACHE_NO_MAX_AGE;
+    session->verifyRetries = -1;
+    session->devicePath[0] = '\0';
+    packInit(&session->pack);
+}
+
+
+
+int checkSerialDevice(session_t * session)
 {
-    if (serialDevice < 0)
+    if (session->serialDevice < 0)
     {
         printf("serial device not open.\n");
-        exit(1);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+// returns NULL for an unknown type
+const char * deviceTypeName(int type)
+{
+    switch(type)
+    {
+    case 0x10: return "VC010 VGA EDID emulator";
+    case 0x60: return "VC060 DVI EDID emulator";
+    case 0x80: return "VC080 HDMI EDID emulator";
+    default:   return NULL;
     }
 }
 
 
 
-void printInquiry(serial_t serialDevice)
+int printInquiry(session_t * session)
 {
-    checkSerialDevice(serialDevice);
+    if (checkSerialDevice(session) != 0)
+        return 1;
 
-    int byte = atenDeviceAttached(serialDevice);
+    int byte = atenDeviceAttached(session->serialDevice);
     if (byte < 0)
+    {
         printf("device didn't reply to identification request\n");
+        return 1;
+    }
+
+    if (deviceTypeName(byte) != NULL)
+        printf("device type is \"%s\"\n", deviceTypeName(byte));
     else
-        switch(byte)
-        {
-        case 0x10: printf("device type is \"VC010 VGA EDID emulator\"\n"); break;
-        case 0x60: printf("device type is \"VC060 DVI EDID emulator\"\n"); break;
-        case 0x80: printf("device type is \"VC080 HDMI EDID emulator\"\n"); break;
-        default:   printf("unknown device type %u (0x%02x)\n", byte, byte); break;
-        }
+        printf("unknown device type %u (0x%02x)\n", byte, byte);
+
+    return 0;
+}
+
+
+
+// Opens the serial port of a device at the rate and RTS state it expects. The port is left closed on error.
+// Input is not purged yet: the caller lets the port settle first, once for all the ports it opens.
+int openDevicePort(serial_t * serialDevice, const char * path, serialSettings_t * previousSettings)
+{
+    if (serialOpenPort(serialDevice, path, previousSettings) != serialOK)
+        return 1;
+
+    if (serialSetRate(*serialDevice, 115200, 115200) != serialOK || serialSetRTS(*serialDevice, 0) != serialOK)
+    {
+        serialClosePort(*serialDevice, previousSettings);       // dismiss errors
+        *serialDevice = serialClosed;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+// identify the device on every port matching pattern, all ports at once on the engine
+int discoverDevices(char * pattern)
+{
+    glob_t paths;
+    serial_t * serialDevices = NULL;
+    serialSettings_t * previousSettings = NULL;
+    engine_port_t * ports = NULL;
+    engine_port_t ** busyPorts = NULL;
+    size_t busyCount = 0;
+    size_t openCount = 0;
+    int result = 1;
+
+
+    if (glob(pattern, 0, NULL, &paths) != 0)
+    {
+        printf("no port matches '%s'\n", pattern);
+        return 1;
+    }
+
+    serialDevices = calloc(paths.gl_pathc, sizeof(serial_t));
+    previousSettings = calloc(paths.gl_pathc, sizeof(serialSettings_t));
+    ports = calloc(paths.gl_pathc, sizeof(engine_port_t));
+    busyPorts = calloc(paths.gl_pathc, sizeof(engine_port_t *));
+    if (serialDevices == NULL || previousSettings == NULL || ports == NULL || busyPorts == NULL)
+    {
+        printf("out of memory\n");
+        goto end;
+    }
+
+    for (size_t i = 0; i < paths.gl_pathc; i++)
+        if (openDevicePort(&serialDevices[i], paths.gl_pathv[i], &previousSettings[i]) == 0)
+            openCount++;
+    if (openCount > 0)
+        pauseMilliseconds(100);
+
+    for (size_t i = 0; i < paths.gl_pathc; i++)
+    {
+        enginePortInit(&ports[i], serialDevices[i], NULL, NULL);
+        if (serialDevices[i] == serialClosed)
+            continue;
+        serialClearPendingBytes(serialDevices[i]);     // purge serial input buffer, dismiss errors
+        if (engineIdentify(&ports[i]) == ATEN_NO_ERROR)
+            busyPorts[busyCount++] = &ports[i];
+    }
+
+    engineRun(busyPorts, busyCount);
+
+    for (size_t i = 0; i < paths.gl_pathc; i++)
+    {
+        int type = ports[i].deviceType;
+
+
+        if (serialDevices[i] == serialClosed)
+            printf("%-32s can't open, busy or not a serial port\n", paths.gl_pathv[i]);
+        else if (type < 0)
+            printf("%-32s no reply\n", paths.gl_pathv[i]);
+        else if (deviceTypeName(type) != NULL)
+            printf("%-32s %s\n", paths.gl_pathv[i], deviceTypeName(type));
+        else
+            printf("%-32s unknown device type 0x%02x\n", paths.gl_pathv[i], type);
+
+        if (serialDevices[i] != serialClosed)
+            serialClosePort(serialDevices[i], &previousSettings[i]);
+    }
+    result = 0;
+
+end:
+    free(serialDevices);
+    free(previousSettings);
+    free(ports);
+    free(busyPorts);
+    globfree(&paths);
+
+    return result;
 }
 
 
 
-void selectSet(serial_t serialDevice, int *currentPosition, char * name)
+const char * setName(int position)
 {
-    checkSerialDevice(serialDevice);
+    switch(position)
+    {
+    case ATEN_SET_DEFAULT: return "DEFAULT set";
+    case ATEN_SET_1:       return "SET 1";
+    case ATEN_SET_2:       return "SET 2";
+    case ATEN_SET_3:       return "SET 3";
+    default:               return "DISPLAY";
+    }
+}
+
 
-    if (strcmp(name, "default") == 0)      *currentPosition = ATEN_SET_DEFAULT;
-    else if (strcmp(name, "DEFAULT") == 0) *currentPosition = ATEN_SET_DEFAULT;
-    else if (strcmp(name, "1") == 0)       *currentPosition = ATEN_SET_1;
-    else if (strcmp(name, "2") == 0)       *currentPosition = ATEN_SET_2;
-    else if (strcmp(name, "3") == 0)       *currentPosition = ATEN_SET_3;
-    else if (strcmp(name, "display") == 0) *currentPosition = ATEN_SET_DISPLAY;
-    else if (strcmp(name, "DISPLAY") == 0) *currentPosition = ATEN_SET_DISPLAY;
+
+// returns 1 if name is not a set name of -s
+int setPosition(const char * name, int * position)
+{
+    if (strcmp(name, "default") == 0)      *position = ATEN_SET_DEFAULT;
+    else if (strcmp(name, "DEFAULT") == 0) *position = ATEN_SET_DEFAULT;
+    else if (strcmp(name, "1") == 0)       *position = ATEN_SET_1;
+    else if (strcmp(name, "2") == 0)       *position = ATEN_SET_2;
+    else if (strcmp(name, "3") == 0)       *position = ATEN_SET_3;
+    else if (strcmp(name, "display") == 0) *position = ATEN_SET_DISPLAY;
+    else if (strcmp(name, "DISPLAY") == 0) *position = ATEN_SET_DISPLAY;
     else
+        return 1;
+
+    return 0;
+}
+
+
+
+int selectSet(session_t * session, char * name)
+{
+    int position;
+
+
+    if (checkSerialDevice(session) != 0)
+        return 1;
+
+    if (setPosition(name, &position) != 0)
     {
         printf("unknown set name '%s'\n", name);
-        exit(1);
+        return 1;
     }
 
-    switch(*currentPosition)
+    session->currentPosition = position;
+    switch(position)
     {
     case ATEN_SET_DEFAULT:
-        atenPosition(serialDevice, *currentPosition);       // dismiss errors
+        atenPosition(session->serialDevice, position);      // dismiss errors
         printf("switched to DEFAULT\n");
         break;
     case ATEN_SET_1:
-        atenPosition(serialDevice, *currentPosition);       // dismiss errors
+        atenPosition(session->serialDevice, position);      // dismiss errors
         printf("switched to SET 1\n");
         break;
     case ATEN_SET_2:
-        atenPosition(serialDevice, *currentPosition);       // dismiss errors
+        atenPosition(session->serialDevice, position);      // dismiss errors
         printf("switched to SET 2\n");
         break;
     case ATEN_SET_3:
-        atenPosition(serialDevice, *currentPosition);       // dismiss errors
+        atenPosition(session->serialDevice, position);      // dismiss errors
         printf("switched to SET 3\n");
         break;
     case ATEN_SET_DISPLAY:
         printf("selected DISPLAY\n");
         break;
     }
+
+    return 0;
 }
 
 
 
-void CECConnect(serial_t serialDevice)
+int CECConnect(session_t * session)
 {
-    checkSerialDevice(serialDevice);
+    if (checkSerialDevice(session) != 0)
+        return 1;
 
-    atenCECConnect(serialDevice);
+    return atenCECConnect(session->serialDevice) == ATEN_NO_ERROR ? 0 : 1;
 }
 
 
 
-void CECDisconnect(serial_t serialDevice)
+int CECDisconnect(session_t * session)
 {
-    checkSerialDevice(serialDevice);
+    if (checkSerialDevice(session) != 0)
+        return 1;
 
-    atenCECDisconnect(serialDevice);
+    return atenCECDisconnect(session->serialDevice) == ATEN_NO_ERROR ? 0 : 1;
 }
 
 
 
-void writeEDIDToDevice(serial_t serialDevice, int currentPosition, char * path)
+// read the selected set or the display, sets may be served from the cache
+int readSet(session_t * session, uint8_t edid[ATEN_MAX_EDID_SIZE])
 {
-    uint8_t edid[ATEN_MAX_EDID_SIZE];
+    int status;
 
 
-    checkSerialDevice(serialDevice);
+    if (session->currentPosition == ATEN_SET_DISPLAY)
+        return atenReadEDIDFromDisplay(session->serialDevice, edid);
 
-    if (currentPosition == ATEN_SET_DISPLAY)
+    if (cacheLoad(session->devicePath, session->currentPosition, edid, session->cacheMaxAge) == 0)
     {
-        printf("can't write display's EDID\n");
-        exit(1);
+        printf("%s read from cache\n", setName(session->currentPosition));
+        return ATEN_NO_ERROR;
     }
 
-    if (currentPosition == ATEN_SET_DEFAULT)
-    {
-        // ATEN EDID Wizard does not allow this, so don't do it either, although DEFAULT is just a normal writable set
-        printf("can't write DEFAULT set\n");
-        exit(1);
-    }
+    status = atenReadEDIDFromDevice(session->serialDevice, edid);
+    if (status == ATEN_NO_ERROR)
+        cacheStore(session->devicePath, session->currentPosition, edid);       // dismiss errors
 
-    if (atenReadEDIDFromFile(edid, path) != ATEN_NO_ERROR || edidIsValid(edid) != ATEN_NO_ERROR)
-    {
-        printf("invalid EDID file\n");
-        exit(1);
-    }
+    return status;
+}
 
-    printf("writing...\n");
-    if (atenWriteEDID(serialDevice, edid) != 0)
+
+
+int setCacheMaxAge(session_t * session, char * seconds)
+{
+    char * end;
+    long maxAge = strtol(seconds, &end, 10);
+
+
+    if (*seconds == '\0' || *end != '\0' || maxAge < 0)
     {
-        printf("write failed\n");
-        exit(1);
+        printf("invalid cache age '%s'\n", seconds);
+        return 1;
     }
 
-    switch(currentPosition)
+    session->cacheMaxAge = maxAge;
+
+    return 0;
+}
+
+
+
+void printEDIDIssues(const edid_info_t * info)
+{
+    char text[128];
+
+
+    for (size_t i = 0; i < info->issueCount && i < EDID_MAX_ISSUES; i++)
     {
-    case ATEN_SET_DEFAULT:
-        printf("written to DEFAULT set\n");
-        break;
-    case ATEN_SET_1:
-        printf("written to SET 1\n");
-        break;
-    case ATEN_SET_2:
-        printf("written to SET 2\n");
-        break;
-    case ATEN_SET_3:
-        printf("written to SET 3\n");
-        break;
+        edidDescribeIssue(&info->issues[i], text, sizeof(text));
+        printf("%s\n", text);
     }
+    if (info->issueCount > EDID_MAX_ISSUES)
+        printf("%zu more issues\n", info->issueCount - EDID_MAX_ISSUES);
 }
 
 
 
-void writeEDIDToFile(serial_t serialDevice, int currentPosition, char * path)
+// source is an EDID file, or pack:NAME for an EDID of a pack, when no file has this path
+int readEDIDSource(session_t * session, char * source, uint8_t edid[ATEN_MAX_EDID_SIZE])
 {
-    int status;
-    uint8_t edid[ATEN_MAX_EDID_SIZE];
+    char packPath[PATH_MAX];
+    const char * name = strchr(source, ':');
+    const uint8_t * packedEDID;
+    unsigned blockCount;
 
 
-    checkSerialDevice(serialDevice);
+    if (name == NULL || access(source, F_OK) == 0)
+        return atenReadEDIDFromFile(edid, source);
 
-    printf("reading...\n");
-    if (currentPosition != ATEN_SET_DISPLAY)
-        status = atenReadEDIDFromDevice(serialDevice, edid);
-    else
-        status = atenReadEDIDFromDisplay(serialDevice, edid);
+    snprintf(packPath, sizeof(packPath), "%.*s", (int) (name - source), source);
+    name++;
+    if (packOpen(&session->pack, packPath) != 0)
+    {
+        printf("%s: not a valid pack\n", packPath);
+        return ATEN_READ_ERROR;
+    }
 
-    if (status != ATEN_NO_ERROR)
+    packedEDID = packLookup(&session->pack, name, &blockCount);
+    if (packedEDID == NULL)
     {
-        printf("can't read EDID\n");
-        if (currentPosition == ATEN_SET_DISPLAY)
-            printf("Is monitor connected?\n");
-        exit(1);
+        printf("%s: no EDID named '%s'\n", packPath, name);
+        return ATEN_READ_ERROR;
     }
+    if (packedEDID[ATEN_EXTENSION_COUNT_OFFSET] + 1u != blockCount)
+    {
+        printf("%s: EDID named '%s' is damaged\n", packPath, name);
+        return ATEN_READ_ERROR;
+    }
+    memcpy(edid, packedEDID, blockCount * ATEN_BLOCK_SIZE);
 
-    status = atenWriteEDIDToFile(edid, path);
-    if (status == ATEN_NO_ERROR)
+    return edidIsValid(edid);
+}
+
+
+
+// argument is pack:directory
+int buildPack(char * argument)
+{
+    char packPath[PATH_MAX];
+    const char * directory = strchr(argument, ':');
+    int skippedCount;
+
+
+    if (directory == NULL || directory == argument || directory[1] == '\0')
     {
-        printf("EDID written to '%s'\n", path);
+        printf("'%s': expected pack:directory\n", argument);
+        return 1;
     }
-    else
+    snprintf(packPath, sizeof(packPath), "%.*s", (int) (directory - argument), argument);
+
+    skippedCount = packBuild(directory + 1, packPath);
+    if (skippedCount > 0)
+        printf("%d file(s) skipped\n", skippedCount);
+
+    return skippedCount < 0 ? 1 : 0;
+}
+
+
+
+int setVerifyRetries(session_t * session, char * retries)
+{
+    char * end;
+    long count = strtol(retries, &end, 10);
+
+
+    if (*retries == '\0' || *end != '\0' || count < 0 || count > 100)
     {
-        printf("file write error\n");
-        exit(1);
+        printf("invalid retry count '%s'\n", retries);
+        return 1;
     }
+
+    session->verifyRetries = (int) count;
+
+    return 0;
 }
 
 
 
-void connectToDevice(int *serialDevice, char * path, struct termios * previousSettings)
+int setPolicy(char * argument)
 {
-    if (serialOpenPort(serialDevice, optarg, previousSettings) != serialOK)
+    static const char * classNames[ATEN_POLICY_COUNT] =
     {
-        perror(optarg);
-        exit(1);
+        [ATEN_POLICY_SWITCH] = "switch",
+        [ATEN_POLICY_READ] = "read",
+        [ATEN_POLICY_DISPLAY] = "display",
+        [ATEN_POLICY_WRITE] = "write",
+        [ATEN_POLICY_FIRMWARE] = "firmware",
+    };
+    char * values = strchr(argument, ':');
+    int policyClass;
+    aten_policy_t policy;
+    char * end;
+
+
+    if (values == NULL)
+        goto invalid;
+
+    for (policyClass = 0; policyClass < ATEN_POLICY_COUNT; policyClass++)
+    {
+        if (strlen(classNames[policyClass]) == (size_t) (values - argument) && strncmp(argument, classNames[policyClass], values - argument) == 0)
+            break;
     }
-    if (serialSetRate(*serialDevice, 115200, 115200) != serialOK || serialSetRTS(*serialDevice, 0) != serialOK)
+    if (policyClass == ATEN_POLICY_COUNT)
+        goto invalid;
+
+    policy = *atenGetPolicy(policyClass);
+    policy.attempts = (unsigned) strtoul(values + 1, &end, 10);
+    if (end == values + 1 || (*end != '\0' && *end != ','))
+        goto invalid;
+    if (*end == ',')
     {
-        printf("Can't initialize serial port\n");
-        exit(1);
+        values = end + 1;
+        policy.wait = strtoumax(values, &end, 10);
+        if (end == values || (*end != '\0' && *end != ','))
+            goto invalid;
+    }
+    if (*end == ',')
+    {
+        values = end + 1;
+        policy.backoff = strtod(values, &end);
+        if (end == values || (*end != '\0' && *end != ','))
+            goto invalid;
+    }
+    if (*end == ',')
+    {
+        values = end + 1;
+        policy.deadline = strtoumax(values, &end, 10);
+        if (end == values || *end != '\0')
+            goto invalid;
     }
-    pauseMilliseconds(100);
-    serialClearPendingBytes(*serialDevice);      // purge serial input buffer, dismiss errors
 
-    printf("Connected using '%s'\n", path);
+    if (atenSetPolicy(policyClass, &policy) != 0)
+        goto invalid;
+
+    return 0;
+
+invalid:
+    printf("invalid policy '%s': expected switch, read, display, write or firmware:attempts[,wait[,backoff[,deadline]]],\n", argument);
+    printf("with at least 1 attempt, a single one for write, a wait of 1 ms or more, and a backoff of 1 or more\n");
+    return 1;
 }
 
 
 
-void firmwareUpdate(serial_t serialDevice, char * path)
+int calibrate(session_t * session, char * samples)
 {
-    int fileDescriptor;
-    size_t byteCount;
-    uint8_t data[ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2 + 2];
+    char * end;
+    long sampleCount = strtol(samples, &end, 10);
+    profile_t profile;
+    int status;
 
 
-    fileDescriptor = open(path, O_RDONLY);
-    if (fileDescriptor < 0)
+    if (*samples == '\0' || *end != '\0' || sampleCount < 1 || sampleCount > 1000)
     {
-        perror(path);
-        exit(1);
+        printf("invalid sample count '%s'\n", samples);
+        return 1;
     }
 
-    byteCount = read(fileDescriptor, data, ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2 + 2);
-    if (byteCount != ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2 + 2)
+    if (checkSerialDevice(session) != 0)
+        return 1;
+
+    // the set is written back, as -w would
+    if (session->currentPosition != ATEN_SET_1 && session->currentPosition != ATEN_SET_2 && session->currentPosition != ATEN_SET_3)
     {
-        perror(path);
-        close(fileDescriptor);
-        exit(1);
+        printf("select SET 1-3 before calibrating\n");
+        return 1;
     }
 
-    printf("Updating firmware...\n");
-    int status = atenUpdateFirmware(serialDevice, data, byteCount);
-    switch (status)
+    printf("calibrating...\n");
+    status = profileCalibrate(session->serialDevice, session->currentPosition, (unsigned) sampleCount, &profile);
+    if (status != ATEN_NO_ERROR)
     {
-    case ATEN_NO_ERROR:
-        printf("Firmware updated\n");
-        break;
+        printf("calibration failed, %s\n", status == ATEN_TIMEOUT ? "device did not reply in time" : "serial I/O error");
+        return 1;
+    }
 
-    case ATEN_READ_ERROR:
-        printf("Firmware update failed.\n");
-        printf("Is EDID emulator in firmware update mode?\n");
-        break;
+    printf("  command    samples    p50    p90    p99    max (ms)\n");
+    for (int command = 0; command < PROFILE_COMMAND_COUNT; command++)
+    {
+        const profile_timing_t * timing = &profile.timings[command];
 
-    case ATEN_INVALID:
-        printf("%s: not a valid firmware file\n", path);
-        printf("Is it still scrambled?\n");
-        break;
+        if (timing->sampleCount == 0)
+            printf("  %-9s  not measured\n", profileCommandName(command));
+        else
+            printf("  %-9s  %7u %6ju %6ju %6ju %6ju\n", profileCommandName(command), timing->sampleCount, timing->p50, timing->p90, timing->p99, timing->max);
+    }
 
-    default:
-        printf("Firmware update failed.\n");
-        break;
+    if (profileStore(session->devicePath, &profile) != 0)
+    {
+        printf("can't store latency profile\n");
+        return 1;
     }
+    profileApply(&profile);
+
+    return 0;
 }
 
 
 
-int main(int argc, char * const argv[])
+// read the selected set back from the device, never from the cache, and report the blocks differing from edid
+// returns the count of differing blocks, -1 if the set can't be read
+int verifySet(session_t * session, uint8_t edid[ATEN_MAX_EDID_SIZE])
 {
-    serial_t serialDevice = serialClosed;
-    int currentPosition = ATEN_SET_DISPLAY;
-    int character;
-    serialSettings_t previousSettings;
+    int status;
+    int blockCount = 1 + edid[ATEN_EXTENSION_COUNT_OFFSET];
+    int mismatchCount = 0;
+    uint8_t readEDID[ATEN_MAX_EDID_SIZE];
 
-    printf("atenvc080 v%s\n", VERSION);
 
-    while ((character = getopt(argc, argv, "?CDF:d:qr:s:w:")) != -1)
+    printf("verifying...\n");
+    // blocks with a bad checksum have been read all the same, and are reported below
+    status = atenReadEDIDFromDevice(session->serialDevice, readEDID);
+    if (status != ATEN_NO_ERROR && status != ATEN_INVALID)
+    {
+        printf(status == ATEN_TIMEOUT ? "can't read back, device did not reply in time\n" : "can't read back\n");
+        return -1;
+    }
+
+    if (readEDID[ATEN_EXTENSION_COUNT_OFFSET] != edid[ATEN_EXTENSION_COUNT_OFFSET])
+        printf("set holds %d extension blocks, %d written\n", readEDID[ATEN_EXTENSION_COUNT_OFFSET],
+               edid[ATEN_EXTENSION_COUNT_OFFSET]);
+
+    for (int block = 0; block < blockCount; block++)
     {
-        switch(character)
+        const uint8_t * written = edid + block * ATEN_BLOCK_SIZE;
+        const uint8_t * read = readEDID + block * ATEN_BLOCK_SIZE;
+        int byteCount = 0;
+        int first = -1;
+
+
+        for (int i = 0; i < ATEN_BLOCK_SIZE; i++)
         {
-        case 'C':
-            CECConnect(serialDevice);
-            break;
-        case 'D':
-            CECDisconnect(serialDevice);
-            break;
-        case 'F':
-            firmwareUpdate(serialDevice, optarg);
-            break;
-        case 'd':
-            connectToDevice(&serialDevice, optarg, &previousSettings);
-            break;
-        case 'q':
-            printInquiry(serialDevice);
-            break;
-        case 'r':
-            writeEDIDToFile(serialDevice, currentPosition, optarg);
-            break;
-        case 's':
-            selectSet(serialDevice, &currentPosition, optarg);
-            break;
-        case 'w':
-            writeEDIDToDevice(serialDevice, currentPosition, optarg);
-            break;
-        case '?':
-        default:
-            usage();
-            exit(1);
-            break;
+            if (written[i] != read[i])
+            {
+                if (first < 0)
+                    first = i;
+                byteCount++;
+            }
+        }
+
+        if (byteCount > 0)
+        {
+            printf("block %d differs: %d byte(s), first at 0x%02x (0x%02x written, 0x%02x read)\n", block, byteCount,
+                   first, written[first], read[first]);
+            mismatchCount++;
         }
     }
 
-    argc -= optind;
-    argv += optind;
+    return mismatchCount;
+}
+
+
+
+int writeEDIDToDevice(session_t * session, char * path)
+{
+    int status;
+    edid_info_t info;
+    uint8_t edid[ATEN_MAX_EDID_SIZE];
+    uint8_t currentEDID[ATEN_MAX_EDID_SIZE];
+
+
+    if (checkSerialDevice(session) != 0)
+        return 1;
 
-    if (argc != 0)
+    if (session->currentPosition == ATEN_SET_DISPLAY)
     {
-        usage();
-        exit(1);
+        printf("can't write display's EDID\n");
+        return 1;
     }
-    if (serialDevice != -1)
-        serialClosePort(serialDevice, &previousSettings);       // dismiss errors
+
+    if (session->currentPosition == ATEN_SET_DEFAULT)
+    {
+        // ATEN EDID Wizard does not allow this, so don't do it either, although DEFAULT is just a normal writable set
+        printf("can't write DEFAULT set\n");
+        return 1;
+    }
+
+    status = readEDIDSource(session, path, edid);
+    if (status == ATEN_READ_ERROR)
+    {
+        printf("invalid EDID file\n");
+        return 1;
+    }
+    status = edidValidate(edid, (1 + edid[ATEN_EXTENSION_COUNT_OFFSET]) * ATEN_BLOCK_SIZE, &info);
+    if (status != ATEN_NO_ERROR)
+        printf("invalid EDID file\n");
+    printEDIDIssues(&info);
+    if (status != ATEN_NO_ERROR)
+        return 1;
+
+    if (edid[ATEN_EXTENSION_COUNT_OFFSET] > 1)
+    {
+        printf("EDID has %d extension blocks, the device holds one at most\n", edid[ATEN_EXTENSION_COUNT_OFFSET]);
+        return 1;
+    }
+
+    // reading back is much cheaper than writing, and saves the EEPROM
+    if (session->skipIdentical)
+    {
+        printf("reading...\n");
+        if (readSet(session, currentEDID) == ATEN_NO_ERROR && edidCompare(edid, currentEDID) == 0)
+        {
+            printf("%s already holds this EDID, write skipped\n", setName(session->currentPosition));
+            return 0;
+        }
+    }
+
+    for (int attempt = 0; ; attempt++)
+    {
+        int mismatchCount;
+
+
+        printf("writing...\n");
+        status = atenWriteEDID(session->serialDevice, edid);
+        if (status != ATEN_NO_ERROR)
+        {
+            cacheInvalidate(session->devicePath, session->currentPosition);    // the set content is unknown
+            printf(status == ATEN_TIMEOUT ? "write failed, device did not reply in time\n" : "write failed\n");
+            return 1;
+        }
+
+        if (session->verifyRetries < 0)
+            break;
+
+        // compared in memory, in the same session
+        mismatchCount = verifySet(session, edid);
+        if (mismatchCount == 0)
+        {
+            printf("verified\n");
+            break;
+        }
+
+        cacheInvalidate(session->devicePath, session->currentPosition);
+        if (attempt == session->verifyRetries)
+        {
+            printf("verification failed after %d write(s)\n", attempt + 1);
+            return 1;
+        }
+        printf("writing again, retry %d of %d\n", attempt + 1, session->verifyRetries);
+    }
+    cacheStore(session->devicePath, session->currentPosition, edid);           // dismiss errors
+
+    switch(session->currentPosition)
+    {
+    case ATEN_SET_DEFAULT:
+        printf("written to DEFAULT set\n");
+        break;
+    case ATEN_SET_1:
+        printf("written to SET 1\n");
+        break;
+    case ATEN_SET_2:
+        printf("written to SET 2\n");
+        break;
+    case ATEN_SET_3:
+        printf("written to SET 3\n");
+        break;
+    }
+
+    return 0;
+}
+
+
+
+int writeEDIDToFile(session_t * session, char * path)
+{
+    int status;
+    uint8_t edid[ATEN_MAX_EDID_SIZE];
+
+
+    if (checkSerialDevice(session) != 0)
+        return 1;
+
+    printf("reading...\n");
+    status = readSet(session, edid);
+
+    if (status != ATEN_NO_ERROR)
+    {
+        printf(status == ATEN_TIMEOUT ? "can't read EDID, device did not reply in time\n" : "can't read EDID\n");
+        if (session->currentPosition == ATEN_SET_DISPLAY)
+            printf("Is monitor connected?\n");
+        return 1;
+    }
+
+    if (strcmp(path, "-") == 0)
+    {
+        for (int i = 0; i < (1 + edid[ATEN_EXTENSION_COUNT_OFFSET]) * ATEN_BLOCK_SIZE; i++)
+            printf("%02x%s", edid[i], (i % 16 == 15) ? "\n" : " ");
+        return 0;
+    }
+
+    status = atenWriteEDIDToFile(edid, path);
+    if (status != ATEN_NO_ERROR)
+    {
+        printf("file write error\n");
+        return 1;
+    }
+
+    printf("EDID written to '%s'\n", path);
+
+    return 0;
+}
+
+
+
+int connectToDevice(session_t * session, char * path)
+{
+    profile_t profile;
+
+
+    closeSession(session);
+
+    if (openDevicePort(&session->serialDevice, path, &session->previousSettings) != 0)
+    {
+        perror(path);
+        return 1;
+    }
+    pauseMilliseconds(100);
+    serialClearPendingBytes(session->serialDevice);     // purge serial input buffer, dismiss errors
+
+    snprintf(session->devicePath, sizeof(session->devicePath), "%s", path);
+    traceProcessName(path);
+    printf("Connected using '%s'\n", path);
+
+    // the profile is of whatever device was calibrated on the path
+    if (profileLoad(path, &profile) == 0)
+    {
+        int deviceType = atenDeviceAttached(session->serialDevice);
+
+        if (deviceType >= 0 && deviceType == profile.deviceType)
+        {
+            profileApply(&profile);
+            printf("waits from the latency profile of the device\n");
+        }
+        else if (deviceType >= 0)
+            printf("latency profile is of another device type, not used\n");
+    }
+
+    return 0;
+}
+
+
+
+void closeSession(session_t * session)
+{
+    if (session->serialDevice != serialClosed)
+        serialClosePort(session->serialDevice, &session->previousSettings);     // dismiss errors
+
+    session->serialDevice = serialClosed;
+}
+
+
+
+// Returns the count of data frames acknowledged before an interrupted update of the image of firmware->digest, 0 if
+// none, and the identity of the device it was flashing in firmware->deviceIdentity.
+size_t readFirmwareJournal(session_t * session, firmwareContext_t * firmware)
+{
+    char path[PATH_MAX];
+    FILE * journal;
+    uint64_t journalDigest;
+    size_t frameCount;
+    char identity[2 * ATEN_FIRMWARE_IDENTITY_SIZE + 1];
+    unsigned byte;
+
+
+    if (cacheDevicePath(path, session->devicePath, "firmware") != 0 || (journal = fopen(path, "r")) == NULL)
+        return 0;
+
+    if (fscanf(journal, "%" SCNx64 " %zu %90s", &journalDigest, &frameCount, identity) != 3 || journalDigest != firmware->digest
+        || frameCount > ATEN_FIRMWARE_SIZE_2 / 64 || strlen(identity) != 2 * ATEN_FIRMWARE_IDENTITY_SIZE)
+        frameCount = 0;
+    fclose(journal);
+
+    for (size_t i = 0; i < ATEN_FIRMWARE_IDENTITY_SIZE && frameCount > 0; i++)
+    {
+        if (sscanf(identity + 2 * i, "%2x", &byte) != 1)
+        {
+            frameCount = 0;
+            break;
+        }
+        firmware->deviceIdentity[i] = byte;
+    }
+
+    return frameCount;
+}
+
+
+
+void writeFirmwareJournal(firmwareContext_t * firmware, size_t frameCount)
+{
+    char record[FIRMWARE_JOURNAL_SIZE + 1];
+    char identity[2 * ATEN_FIRMWARE_IDENTITY_SIZE + 1];
+
+
+    if (firmware->journal < 0)
+        return;
+
+    for (size_t i = 0; i < ATEN_FIRMWARE_IDENTITY_SIZE; i++)
+        snprintf(identity + 2 * i, 3, "%02x", firmware->deviceIdentity[i]);
+    snprintf(record, sizeof(record), FIRMWARE_JOURNAL_FORMAT, firmware->digest, frameCount, identity);
+    if (pwrite(firmware->journal, record, FIRMWARE_JOURNAL_SIZE, 0) != FIRMWARE_JOURNAL_SIZE)
+    {
+        printf("can't journal the update, it won't be resumable\n");
+        close(firmware->journal);
+        firmware->journal = -1;
+    }
+}
+
+
+
+// Progress is updated in place on a terminal, otherwise printed every 10%, as output may be relayed line by line.
+void firmwareProgress(const aten_firmware_progress_t * progress, void * context)
+{
+    firmwareContext_t * firmware = context;
+    int step = (int) (progress->byteCount * 10 / progress->totalByteCount);
+    size_t sentByteCount = progress->byteCount - progress->resumedByteCount;
+    uintmax_t bytesPerSecond = progress->elapsed > 0 ? sentByteCount * 1000 / progress->elapsed : 0;
+
+
+    // from the 0xa2 frame on, the journal is the device's
+    memcpy(firmware->deviceIdentity, progress->deviceIdentity, ATEN_FIRMWARE_IDENTITY_SIZE);
+    writeFirmwareJournal(firmware, (progress->byteCount - ATEN_FIRMWARE_SIZE_1) / 64);
+
+    if (isatty(STDOUT_FILENO))
+    {
+        printf("\r  %5zu/%zu bytes, %4ju bytes/s, round trip %3ju ms", progress->byteCount, progress->totalByteCount, bytesPerSecond, progress->roundTrip);
+        if (progress->byteCount == progress->totalByteCount)
+            printf("\n");
+        fflush(stdout);
+    }
+    else if (step != firmware->lastStep)
+        printf("  %3d%%, %4ju bytes/s, round trip %3ju ms\n", step * 10, bytesPerSecond, progress->roundTrip);
+
+    firmware->lastStep = step;
+}
+
+
+
+// With resume, the data frames acknowledged before an interrupted update of the same image on the same device are not
+// sent again.
+int firmwareUpdate(session_t * session, char * path, int resume)
+{
+    int fileDescriptor;
+    firmwareContext_t firmware;
+    char journalPath[PATH_MAX];
+    size_t resumedFrameCount = 0;
+    aten_firmware_progress_t progress;
+    size_t byteCount;
+    uint8_t data[ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2 + 2];
+
+
+    if (checkSerialDevice(session) != 0)
+        return 1;
+
+    fileDescriptor = open(path, O_RDONLY);
+    if (fileDescriptor < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    byteCount = read(fileDescriptor, data, ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2 + 2);
+    close(fileDescriptor);
+    if (byteCount != ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2 + 2)
+    {
+        perror(path);
+        return 1;
+    }
+
+    firmware.lastStep = 0;
+    firmware.digest = edidDigestBytes(data, byteCount);
+    bzero(firmware.deviceIdentity, sizeof(firmware.deviceIdentity));
+    if (resume)
+    {
+        resumedFrameCount = readFirmwareJournal(session, &firmware);
+        if (resumedFrameCount == 0)
+            printf("No interrupted update with this firmware, updating from the start\n");
+        else
+            printf("Resuming after %zu of %d data frames\n", resumedFrameCount, ATEN_FIRMWARE_SIZE_2 / 64);
+    }
+
+    firmware.journal = -1;
+    if (cacheDevicePath(journalPath, session->devicePath, "firmware") == 0)
+        firmware.journal = open(journalPath, O_WRONLY | O_CREAT, 0644);
+    if (firmware.journal < 0)
+        printf("can't journal the update, it won't be resumable\n");
+    writeFirmwareJournal(&firmware, resumedFrameCount);
+
+    printf("Updating firmware...\n");
+    int status = atenResumeFirmware(session->serialDevice, data, byteCount, resumedFrameCount * 64, firmware.deviceIdentity, &progress, firmwareProgress, &firmware);
+    if (firmware.journal >= 0)
+    {
+        close(firmware.journal);
+        if (status == ATEN_NO_ERROR)
+            unlink(journalPath);
+    }
+    if (progress.frameCount > 0)
+    {
+        size_t sentByteCount = progress.byteCount - progress.resumedByteCount;
+
+        printf("%zu bytes in %ju.%ju s", sentByteCount, progress.elapsed / 1000, progress.elapsed % 1000 / 100);
+        if (progress.elapsed > 0)
+            printf(", %ju bytes/s", sentByteCount * 1000 / progress.elapsed);
+        printf(", round trip min/avg/max %ju/%ju/%ju ms\n", progress.minRoundTrip, progress.totalRoundTrip / progress.frameCount, progress.maxRoundTrip);
+    }
+    switch (status)
+    {
+    case ATEN_NO_ERROR:
+        printf("Firmware updated\n");
+        break;
+
+    case ATEN_READ_ERROR:
+    case ATEN_TIMEOUT:
+        printf("Firmware update failed.\n");
+        printf("Is EDID emulator in firmware update mode?\n");
+        break;
+
+    case ATEN_INVALID:
+        printf("%s: not a valid firmware file\n", path);
+        printf("Is it still scrambled?\n");
+        break;
+
+    default:
+        printf("Firmware update failed.\n");
+        break;
+    }
+
+    return status == ATEN_NO_ERROR ? 0 : 1;
+}
+
+
+
+// Each line holds an option of the command line with its argument, the leading '-' being optional.
+// When served to a client of -L, only SERVER_COMMANDS are run. Returns the count of failed commands.
+int runScriptFile(session_t * session, FILE * script, int served)
+{
+    const char * commands = served ? SERVER_COMMANDS : SCRIPT_COMMANDS;
+    char line[1024];
+    int failedCount = 0;
+
+
+    while (fgets(line, sizeof(line), script) != NULL)
+    {
+        char * command = line;
+        char * argument;
+        const char * option;
+        size_t length;
+        int status;
+
+
+        length = strlen(line);
+        while (length > 0 && strchr(" \t\r\n", line[length - 1]) != NULL)
+            line[--length] = '\0';
+        while (*command == ' ' || *command == '\t')
+            command++;
+        if (*command == '\0' || *command == '#')
+            continue;
+
+        argument = command + (*command == '-' ? 1 : 0);
+        option = strchr(OPTIONS, *argument);
+        if (*argument == '\0' || strchr(commands, *argument) == NULL || option == NULL)
+        {
+            printf("%s: unknown command\n", command);
+            failedCount++;
+            continue;
+        }
+        argument++;
+        while (*argument == ' ' || *argument == '\t')
+            argument++;
+        if ((option[1] == ':') != (*argument != '\0'))
+        {
+            printf("%s: %s\n", command, option[1] == ':' ? "missing argument" : "unexpected argument");
+            failedCount++;
+            continue;
+        }
+        if (served && option[0] == 'r' && strcmp(argument, "-") != 0)
+        {
+            printf("%s: only 'r -' is served\n", command);
+            failedCount++;
+            continue;
+        }
+
+        status = runOption(session, option[0], argument);
+        printf("%s: %s\n", command, status == 0 ? "ok" : "failed");
+        fflush(stdout);
+        if (status != 0)
+            failedCount++;
+    }
+
+    return failedCount;
+}
+
+
+
+int runScript(session_t * session, char * path)
+{
+    FILE * script;
+    int failedCount;
+
+
+    if (strcmp(path, "-") == 0)
+        return runScriptFile(session, stdin, 0);
+
+    script = fopen(path, "r");
+    if (script == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+
+    failedCount = runScriptFile(session, script, 0);
+    fclose(script);
+
+    return failedCount;
+}
+
+
+
+// A manifest describes the state of a device, one entry per line:
+//   1, 2 or 3 followed by an EDID source as for -w, for the set to hold it
+//   'cec on' or 'cec off'
+//   'active' followed by a set name as for -s, DISPLAY excepted, for the set to finish on
+// Empty lines and lines starting with '#' are ignored. Returns 1 if the manifest is invalid.
+int readManifest(const char * path, manifest_t * manifest)
+{
+    FILE * file;
+    char line[PATH_MAX + 16];
+    unsigned lineNumber = 0;
+    int status = 0;
+
+
+    memset(manifest, 0, sizeof(*manifest));
+    manifest->cec = -1;
+    manifest->activePosition = ATEN_SET_DISPLAY;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+
+    while (status == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        char * key = line;
+        char * value;
+        size_t length;
+        int position;
+
+
+        lineNumber++;
+        length = strlen(line);
+        while (length > 0 && strchr(" \t\r\n", line[length - 1]) != NULL)
+            line[--length] = '\0';
+        while (*key == ' ' || *key == '\t')
+            key++;
+        if (*key == '\0' || *key == '#')
+            continue;
+
+        value = key + strcspn(key, " \t");
+        if (*value != '\0')
+            *value++ = '\0';
+        while (*value == ' ' || *value == '\t')
+            value++;
+
+        status = 1;
+        if (*value == '\0')
+            printf("%s:%u: missing value\n", path, lineNumber);
+        else if (strcmp(key, "cec") == 0)
+        {
+            if (strcmp(value, "on") == 0)       manifest->cec = 1, status = 0;
+            else if (strcmp(value, "off") == 0) manifest->cec = 0, status = 0;
+            else
+                printf("%s:%u: cec is 'on' or 'off'\n", path, lineNumber);
+        }
+        else if (strcmp(key, "active") == 0)
+        {
+            if (setPosition(value, &position) != 0 || position == ATEN_SET_DISPLAY)
+                printf("%s:%u: unknown set name '%s'\n", path, lineNumber, value);
+            else
+                manifest->activePosition = position, status = 0;
+        }
+        else if (setPosition(key, &position) != 0 || position < ATEN_SET_1 || position > ATEN_SET_3)
+            printf("%s:%u: unknown entry '%s'\n", path, lineNumber, key);
+        else if (manifest->sources[position][0] != '\0')
+            printf("%s:%u: %s given twice\n", path, lineNumber, setName(position));
+        else if (strlen(value) >= sizeof(manifest->sources[position]))
+            printf("%s:%u: source too long\n", path, lineNumber);
+        else
+        {
+            strcpy(manifest->sources[position], value);
+            status = 0;
+        }
+    }
+
+    if (status == 0 && ferror(file))
+    {
+        perror(path);
+        status = 1;
+    }
+    fclose(file);
+
+    return status;
+}
+
+
+
+// Plans, then provisions the device described by the manifest at path. Sets the cache knows to already hold
+// their EDID are left alone, the others are visited starting with the selected set and ending with the set to
+// finish on, so that each switch is made once at most. The cache is kept per device path, not per unit: a set
+// skipped is only as right as the cache, as the plan says.
+int provisionManifest(session_t * session, char * path)
+{
+    static char * const setArguments[] = { "DEFAULT", "1", "2", "3" };
+    manifest_t manifest;
+    edid_info_t info;
+    uint8_t edid[ATEN_MAX_EDID_SIZE];
+    uint8_t cachedEDID[ATEN_MAX_EDID_SIZE];
+    int planned[ATEN_SET_3 + 1] = { 0 };
+    int order[ATEN_SET_3];
+    int orderCount = 0;
+    int skippedCount = 0;
+    int position;
+    int switchCount = 0;
+    int failedCount = 0;
+    int skipIdentical;
+    int i;
+
+
+    if (checkSerialDevice(session) != 0)
+        return 1;
+
+    if (readManifest(path, &manifest) != 0)
+        return 1;
+
+    // every EDID is checked before the device is touched
+    for (position = ATEN_SET_1; position <= ATEN_SET_3; position++)
+    {
+        const char * source = manifest.sources[position];
+
+
+        if (source[0] == '\0')
+            continue;
+
+        if (readEDIDSource(session, manifest.sources[position], edid) == ATEN_READ_ERROR
+            || edidValidate(edid, (1 + edid[ATEN_EXTENSION_COUNT_OFFSET]) * ATEN_BLOCK_SIZE, &info) != ATEN_NO_ERROR
+            || edid[ATEN_EXTENSION_COUNT_OFFSET] > 1)
+        {
+            printf("%s: %s is not an EDID the device can hold\n", setName(position), source);
+            return 1;
+        }
+
+        planned[position] = cacheLoad(session->devicePath, position, cachedEDID, session->cacheMaxAge) != 0
+                            || edidCompare(edid, cachedEDID) != 0;
+    }
+
+    if (session->currentPosition >= ATEN_SET_1 && planned[session->currentPosition])
+        order[orderCount++] = session->currentPosition;
+    for (position = ATEN_SET_1; position <= ATEN_SET_3; position++)
+        if (planned[position] && position != session->currentPosition && position != manifest.activePosition)
+            order[orderCount++] = position;
+    if (manifest.activePosition >= ATEN_SET_1 && planned[manifest.activePosition] && manifest.activePosition != session->currentPosition)
+        order[orderCount++] = manifest.activePosition;
+
+    printf("plan:\n");
+    position = session->currentPosition;
+    for (i = 0; i < orderCount; i++)
+    {
+        if (order[i] != position)
+            switchCount++;
+        position = order[i];
+        printf("  %d. %-8s write %s, unless it already holds it\n", i + 1, setName(position), manifest.sources[position]);
+    }
+    for (i = ATEN_SET_1; i <= ATEN_SET_3; i++)
+    {
+        if (manifest.sources[i][0] != '\0' && !planned[i])
+        {
+            printf("     %-8s holds %s according to the cache, skipped\n", setName(i), manifest.sources[i]);
+            skippedCount++;
+        }
+    }
+    if (manifest.cec != -1)
+        printf("     CEC %s\n", manifest.cec ? "connect" : "disconnect");
+    if (manifest.activePosition != ATEN_SET_DISPLAY && manifest.activePosition != position)
+        switchCount++;
+    else if (manifest.activePosition == ATEN_SET_DISPLAY)
+        manifest.activePosition = position;
+    printf("     finish on %s, %d switch%s\n", setName(manifest.activePosition), switchCount, switchCount == 1 ? "" : "es");
+    if (skippedCount > 0)
+        printf("     skipped sets are not read: after swapping the unit on '%s', give -n before -m\n", session->devicePath);
+    fflush(stdout);
+
+    skipIdentical = session->skipIdentical;
+    session->skipIdentical = 1;
+    for (i = 0; i < orderCount; i++)
+    {
+        if (order[i] != session->currentPosition && selectSet(session, setArguments[order[i]]) != 0)
+        {
+            failedCount++;
+            continue;
+        }
+        if (writeEDIDToDevice(session, manifest.sources[order[i]]) != 0)
+            failedCount++;
+    }
+    session->skipIdentical = skipIdentical;
+
+    if (manifest.cec == 1 && CECConnect(session) != 0)
+        failedCount++;
+    if (manifest.cec == 0 && CECDisconnect(session) != 0)
+        failedCount++;
+
+    if (manifest.activePosition != ATEN_SET_DISPLAY && manifest.activePosition != session->currentPosition
+        && selectSet(session, setArguments[manifest.activePosition]) != 0)
+        failedCount++;
+
+    if (failedCount != 0)
+        printf("%s: %d step%s failed\n", path, failedCount, failedCount == 1 ? "" : "s");
+
+    return failedCount == 0 ? 0 : 1;
+}
+
+
+
+// set on SIGINT or SIGTERM by -L and -M
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int signalNumber)
+{
+    stopRequested = 1;
+}
+
+
+
+// The serial device stays open between requests, so does the session state such as the selected set.
+// The socket is only accessible to the user of the server, and a client is dropped after SERVER_TIMEOUT idle seconds.
+int serveRequests(session_t * session, char * path)
+{
+    struct sockaddr_un address;
+    struct sigaction action;
+    struct stat status;
+    struct timeval timeout = { SERVER_TIMEOUT, 0 };
+    mode_t previousMask;
+    int server;
+    int bound;
+
+
+    if (checkSerialDevice(session) != 0)
+        return 1;
+
+    bzero(&address, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        printf("%s: socket path too long\n", path);
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+
+    // remove a socket left over by a previous server, but nothing else
+    if (stat(path, &status) == 0 && S_ISSOCK(status.st_mode))
+        unlink(path);
+
+    server = socket(AF_UNIX, SOCK_STREAM, 0);
+    previousMask = umask(0077);        // the socket is created 0600
+    bound = (server != -1 && bind(server, (struct sockaddr *) &address, sizeof(address)) == 0);
+    umask(previousMask);
+    if (!bound || listen(server, 16) == -1)
+    {
+        perror(path);
+        if (server != -1)
+            close(server);
+        return 1;
+    }
+
+    // no SA_RESTART, so that accept() returns when interrupted
+    bzero(&action, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);       // a client leaving early must not kill the server
+
+    printf("serving requests on '%s'\n", path);
+    fflush(stdout);
+
+    while (!stopRequested)
+    {
+        int client;
+        int savedOutput;
+        FILE * requests;
+        int failedCount;
+        int timedOut;
+
+
+        client = accept(server, NULL, NULL);
+        if (client == -1)
+        {
+            if (errno != EINTR)
+                perror("accept");
+            continue;
+        }
+
+        // a client that neither sends nor reads must not hold the other ones
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        requests = fdopen(dup(client), "r");
+        if (requests == NULL)
+        {
+            close(client);
+            continue;
+        }
+
+        // command output goes to the client
+        fflush(stdout);
+        savedOutput = dup(STDOUT_FILENO);
+        dup2(client, STDOUT_FILENO);
+        close(client);
+
+        failedCount = runScriptFile(session, requests, 1);
+        timedOut = ferror(requests) && (errno == EAGAIN || errno == EWOULDBLOCK);
+
+        fflush(stdout);
+        dup2(savedOutput, STDOUT_FILENO);
+        close(savedOutput);
+        fclose(requests);
+
+        printf("request %s, %d failed command(s)\n", timedOut ? "timed out" : "served", failedCount);
+        fflush(stdout);
+    }
+
+    close(server);
+    unlink(path);
+    printf("server stopped\n");
+
+    return 0;
+}
+
+
+
+// edid is NULL when the display doesn't reply
+void printMonitorEvent(const char * event, uint8_t edid[ATEN_MAX_EDID_SIZE])
+{
+    char date[32];
+    time_t now = time(NULL);
+    edid_info_t info;
+
+
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    if (edid == NULL)
+    {
+        printf("%s %s\n", date, event);
+        fflush(stdout);
+        return;
+    }
+
+    edidValidate(edid, (1 + edid[ATEN_EXTENSION_COUNT_OFFSET]) * ATEN_BLOCK_SIZE, &info);
+    printf("%s %s: %016llx %s 0x%04x '%s', %d blocks%s\n", date, event, (unsigned long long) edidDigest(edid),
+           info.manufacturer, info.product, info.name, info.blockCount, info.errorCount == 0 ? "" : ", invalid");
+    fflush(stdout);
+}
+
+
+
+// Polls read the base block only, compared with the previous one by digest. Extensions are read right after a
+// base block that changed, so a display keeping the same base block but changing its extensions goes unnoticed.
+int monitorDisplay(session_t * session, char * interval)
+{
+    char * end;
+    double seconds = strtod(interval, &end);
+    uintmax_t milliseconds;
+    struct sigaction action;
+    uint8_t edid[ATEN_MAX_EDID_SIZE];
+    uint64_t baseDigest = 0;
+    int connected = -1;             // unknown until the first poll
+    unsigned long pollCount = 0;
+    unsigned long changeCount = 0;
+    unsigned long blockCount = 0;
+
+
+    if (checkSerialDevice(session) != 0)
+        return 1;
+
+    if (*interval == '\0' || *end != '\0' || seconds < 0.1 || seconds > 86400)
+    {
+        printf("invalid interval '%s'\n", interval);
+        return 1;
+    }
+    milliseconds = (uintmax_t) (seconds * 1000);
+
+    bzero(&action, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("monitoring display EDID every %g s\n", seconds);
+    fflush(stdout);
+
+    while (!stopRequested)
+    {
+        uintmax_t due = monotonicMilliseconds() + milliseconds;
+        uintmax_t now;
+        uint64_t digest;
+        int status;
+
+
+        pollCount++;
+        status = atenReadBaseBlockFromDisplay(session->serialDevice, edid);
+        if (status == ATEN_READ_ERROR || status == ATEN_TIMEOUT)
+        {
+            if (connected != 0)
+                printMonitorEvent("display not replying", NULL);
+            connected = 0;
+            goto wait;
+        }
+        blockCount++;
+
+        digest = edidDigestBytes(edid, ATEN_BLOCK_SIZE);
+        if (connected == 1 && digest == baseDigest)
+            goto wait;
+
+        for (int extension = 0; extension < edid[ATEN_EXTENSION_COUNT_OFFSET]; extension++)
+        {
+            if (atenGetExtensionData(session->serialDevice, extension, edid) != ATEN_NO_ERROR)
+                goto wait;      // read again on next poll
+            blockCount++;
+        }
+
+        printMonitorEvent(connected == -1 ? "display EDID" : connected == 0 ? "display connected" : "display EDID changed", edid);
+        if (connected == 1)
+            changeCount++;
+        baseDigest = digest;
+        connected = 1;
+
+    wait:
+        while (!stopRequested && (now = monotonicMilliseconds()) < due)
+            pauseMilliseconds(due - now < 100 ? due - now : 100);
+    }
+
+    printf("monitor stopped, %lu polls, %lu changes, %lu blocks read\n", pollCount, changeCount, blockCount);
+
+    return 0;
+}
+
+
+
+int runOption(session_t * session, int character, char * argument)
+{
+    switch(character)
+    {
+    case 'B': return buildPack(argument);
+    case 'C': return CECConnect(session);
+    case 'D': return CECDisconnect(session);
+    case 'F': return firmwareUpdate(session, argument, 0);
+    case 'H': printf("-H must come first, after -T\n"); return 1;
+    case 'K': return calibrate(session, argument);
+    case 'L': return serveRequests(session, argument);
+    case 'M': return monitorDisplay(session, argument);
+    case 'R': return firmwareUpdate(session, argument, 1);
+    case 'S': return scanLibrary(argument) == 0 ? 0 : 1;
+    case 'T': printf("-T must come before -d\n"); return 1;
+    case 'a': return setCacheMaxAge(session, argument);
+    case 'b': return runScript(session, argument) == 0 ? 0 : 1;
+    case 'd': return connectToDevice(session, argument);
+    case 'i': session->skipIdentical = 1; return 0;
+    case 'l': return discoverDevices(argument);
+    case 'm': return provisionManifest(session, argument);
+    case 'n': session->cacheMaxAge = CACHE_NO_MAX_AGE; return 0;
+    case 'q': return printInquiry(session);
+    case 'r': return writeEDIDToFile(session, argument);
+    case 's': return selectSet(session, argument);
+    case 't': return setPolicy(argument);
+    case 'v': return setVerifyRetries(session, argument);
+    case 'w': return writeEDIDToDevice(session, argument);
+    default:  return 1;
+    }
+}
+
+
+
+void runOptions(int argc, char * const argv[], session_t * session)
+{
+    int character;
+
+
+    while ((character = getopt(argc, argv, OPTIONS)) != -1)
+    {
+        if (character == '?')
+        {
+            usage();
+            exit(1);
+        }
+
+        if (runOption(session, character, optarg) != 0)
+        {
+            closeSession(session);
+            exit(1);
+        }
+    }
+
+    if (optind != argc)
+    {
+        usage();
+        exit(1);
+    }
+}
+
+
+
+// Collect the devices of the leading -d options, expanding patterns, or the pattern of a leading -H option,
+// and open the trace of a leading -T option.
+// Returns the index of the first remaining argument.
+int collectLeadingOptions(int argc, char * const argv[], glob_t * devicePaths, char ** watchPattern)
+{
+    int index = 1;
+    int flags = GLOB_NOCHECK;       // a path that matches nothing is kept, opening it will report the error
+    const char * pattern;
+
+
+    bzero(devicePaths, sizeof(*devicePaths));
+    *watchPattern = NULL;
+
+    if (index + 1 < argc && strcmp(argv[index], "-T") == 0)
+    {
+        if (traceOpen(argv[index + 1]) != 0)
+        {
+            perror(argv[index + 1]);
+            exit(1);
+        }
+        atexit(traceClose);     // workers only close their descriptor, the parent ends the trace
+        index += 2;
+    }
+
+    if (index + 1 < argc && strcmp(argv[index], "-H") == 0)
+    {
+        *watchPattern = argv[index + 1];
+        return index + 2;
+    }
+
+    while (index < argc)
+    {
+        if (strcmp(argv[index], "-d") == 0 && index + 1 < argc)
+        {
+            pattern = argv[index + 1];
+            index += 2;
+        }
+        else if (strncmp(argv[index], "-d", 2) == 0 && argv[index][2] != '\0')
+        {
+            pattern = argv[index] + 2;
+            index += 1;
+        }
+        else
+            break;
+
+        if (glob(pattern, flags, NULL, devicePaths) != 0)
+        {
+            printf("can't expand '%s'\n", pattern);
+            exit(1);
+        }
+        flags |= GLOB_APPEND;
+    }
+
+    return index;
+}
+
+
+
+int runOnDevice(const char * path, void * context)
+{
+    optionsContext_t * options = context;
+    session_t session;
+
+
+    initSession(&session);
+    if (connectToDevice(&session, (char *) path) != 0)
+        return 1;
+
+    optind = options->firstOption;
+    runOptions(options->argc, options->argv, &session);
+    closeSession(&session);
+
+    return 0;
+}
+
+
+
+// A new device may not be usable yet, when udev has still to give it its owner and mode,
+// or a pseudo-terminal to be unlocked: it is given two seconds to open.
+int provisionDevice(const char * path, void * context)
+{
+    optionsContext_t * options = context;
+    session_t session;
+    int descriptor;
+    int type;
+
+
+    for (int attempt = 0; attempt < 20; attempt++)
+    {
+        descriptor = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (descriptor != -1)
+        {
+            close(descriptor);
+            break;
+        }
+        pauseMilliseconds(100);
+    }
+
+    initSession(&session);
+    if (connectToDevice(&session, (char *) path) != 0)
+        return 1;
+
+    type = atenDeviceAttached(session.serialDevice);
+    if (type < 0)
+    {
+        printf("device didn't reply to identification request, left alone\n");
+        closeSession(&session);
+        return 1;
+    }
+    if (deviceTypeName(type) != NULL)
+        printf("device type is \"%s\"\n", deviceTypeName(type));
+    else
+        printf("unknown device type %u (0x%02x)\n", type, type);
+
+    optind = options->firstOption;
+    runOptions(options->argc, options->argv, &session);
+    closeSession(&session);
+
+    return 0;
+}
+
+
+
+int main(int argc, char * const argv[])
+{
+    session_t session;
+    optionsContext_t options;
+    glob_t devicePaths;
+    char * watchPattern;
+
+    printf("atenvc080 v%s\n", VERSION);
+
+    options.argc = argc;
+    options.argv = argv;
+    options.firstOption = collectLeadingOptions(argc, argv, &devicePaths, &watchPattern);
+
+    if (watchPattern != NULL)
+        return workersWatch(watchPattern, provisionDevice, &options) == 0 ? 0 : 1;
+
+    if (devicePaths.gl_pathc > 1)
+    {
+        size_t failedCount = workersRun(devicePaths.gl_pathv, devicePaths.gl_pathc, runOnDevice, &options);
+
+        globfree(&devicePaths);
+        return failedCount == 0 ? 0 : 1;
+    }
+
+    initSession(&session);
+    if (devicePaths.gl_pathc == 1 && connectToDevice(&session, devicePaths.gl_pathv[0]) != 0)
+        exit(1);
+    globfree(&devicePaths);
+
+    optind = options.firstOption;
+    runOptions(argc, argv, &session);
+    closeSession(&session);
 
     return 0;
 }
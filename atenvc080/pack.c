@@ -0,0 +1,442 @@
+//
+//  pack.c
+//  atenvc080
+//
+
+#if !defined(__APPLE__)
+#define _GNU_SOURCE                             // nftw() with glibc
+#endif
+
+#include "pack.h"
+#include "edid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+#define PACK_MAGIC              "AVC080PK"
+#define PACK_VERSION            1
+#define PACK_HEADER_SIZE        32
+#define PACK_SLOT_SIZE          16
+
+
+
+typedef struct
+{
+    char * name;
+    uint64_t digest;
+    uint8_t * edid;
+    size_t byteCount;
+    uint32_t edidOffset;            // in the pack, shared by identical EDIDs
+} packEntry_t;
+
+typedef struct
+{
+    const char * directory;
+    packEntry_t * entries;
+    size_t entryCount;
+    size_t capacity;
+    int skippedCount;
+} packBuilder_t;
+
+
+
+static packBuilder_t * walkedBuilder;      // nftw() has no context argument
+
+
+
+static uint32_t packGet32(const uint8_t * bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+
+
+static void packPut32(uint8_t * bytes, uint32_t value)
+{
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+}
+
+
+
+static uint32_t packHash(const char * name, size_t length)
+{
+    return (uint32_t) edidDigestBytes((const uint8_t *) name, length);
+}
+
+
+
+void packInit(pack_t * pack)
+{
+    pack->path[0] = '\0';
+    pack->bytes = NULL;
+    pack->size = 0;
+}
+
+
+
+int packOpen(pack_t * pack, const char * path)
+{
+    struct stat status;
+    const uint8_t * bytes;
+    int fileDescriptor;
+    uint32_t slotCount;
+    uint32_t slotsOffset;
+
+
+    // already mapped, unless the pack was rebuilt or replaced since
+    if (pack->bytes != NULL && strcmp(pack->path, path) == 0 && stat(path, &status) == 0
+        && status.st_dev == pack->device && status.st_ino == pack->inode && status.st_mtime == pack->modificationTime)
+        return 0;
+    packClose(pack);
+
+    fileDescriptor = open(path, O_RDONLY);
+    if (fileDescriptor < 0)
+        return -1;
+
+    if (fstat(fileDescriptor, &status) != 0 || status.st_size < PACK_HEADER_SIZE)
+    {
+        close(fileDescriptor);
+        return -1;
+    }
+
+    bytes = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+    close(fileDescriptor);
+    if (bytes == MAP_FAILED)
+        return -1;
+
+    slotCount = packGet32(bytes + 12);
+    slotsOffset = packGet32(bytes + 24);
+    if (memcmp(bytes, PACK_MAGIC, 8) != 0 || packGet32(bytes + 8) != PACK_VERSION
+        || slotCount == 0 || (slotCount & (slotCount - 1)) != 0
+        || slotsOffset > status.st_size || (status.st_size - slotsOffset) / PACK_SLOT_SIZE < slotCount)
+    {
+        munmap((void *) bytes, status.st_size);
+        return -1;
+    }
+
+    snprintf(pack->path, sizeof(pack->path), "%s", path);
+    pack->bytes = bytes;
+    pack->size = status.st_size;
+    pack->slotCount = slotCount;
+    pack->nameCount = packGet32(bytes + 16);
+    pack->edidCount = packGet32(bytes + 20);
+    pack->device = status.st_dev;
+    pack->inode = status.st_ino;
+    pack->modificationTime = status.st_mtime;
+
+    return 0;
+}
+
+
+
+void packClose(pack_t * pack)
+{
+    if (pack->bytes != NULL)
+        munmap((void *) pack->bytes, pack->size);
+
+    packInit(pack);
+}
+
+
+
+// open addressing with linear probing, the table is at most half full
+const uint8_t * packLookup(const pack_t * pack, const char * name, unsigned * blockCount)
+{
+    size_t length = strlen(name);
+    uint32_t hash = packHash(name, length);
+    const uint8_t * slots;
+
+
+    if (pack->bytes == NULL || length == 0)
+        return NULL;
+    slots = pack->bytes + packGet32(pack->bytes + 24);
+
+    for (uint32_t probe = 0; probe < pack->slotCount; probe++)
+    {
+        const uint8_t * slot = slots + ((hash + probe) & (pack->slotCount - 1)) * PACK_SLOT_SIZE;
+        uint32_t nameOffset = packGet32(slot + 4);
+        uint32_t nameLength = slot[8] | (slot[9] << 8);
+        uint32_t edidOffset = packGet32(slot + 10);
+        uint32_t edidBlockCount = slot[14] | (slot[15] << 8);
+
+
+        if (nameLength == 0)
+            return NULL;
+
+        if (packGet32(slot) != hash || nameLength != length || nameLength > pack->size || nameOffset > pack->size - nameLength
+            || memcmp(pack->bytes + nameOffset, name, length) != 0)
+            continue;
+
+        if (edidBlockCount == 0 || edidBlockCount > 1 + ATEN_MAX_EXTENSION_COUNT
+            || edidOffset > pack->size || (pack->size - edidOffset) / ATEN_BLOCK_SIZE < edidBlockCount)
+            return NULL;        // damaged pack
+
+        *blockCount = edidBlockCount;
+        return pack->bytes + edidOffset;
+    }
+
+    return NULL;
+}
+
+
+
+// Files are named after their path under the directory, without a ".bin" suffix.
+static int packAddFile(const char * path, const struct stat * status, int type, struct FTW * ftw)
+{
+    packBuilder_t * builder = walkedBuilder;
+    packEntry_t * entry;
+    const char * name = path + strlen(builder->directory);
+    uint8_t edid[ATEN_MAX_EDID_SIZE];
+    size_t nameLength;
+    int fileDescriptor;
+    ssize_t byteCount;
+
+
+    if (type != FTW_F || !S_ISREG(status->st_mode))
+        return 0;
+
+    if (builder->entryCount == builder->capacity)
+    {
+        size_t capacity = builder->capacity == 0 ? 256 : 2 * builder->capacity;
+        packEntry_t * entries = realloc(builder->entries, capacity * sizeof(packEntry_t));
+
+
+        if (entries == NULL)
+            return -1;
+        builder->entries = entries;
+        builder->capacity = capacity;
+    }
+    entry = &builder->entries[builder->entryCount];
+
+    fileDescriptor = open(path, O_RDONLY);
+    if (fileDescriptor < 0)
+    {
+        printf("%s: can't read, skipped\n", path);
+        builder->skippedCount++;
+        return 0;
+    }
+    byteCount = read(fileDescriptor, edid, sizeof(edid));
+    close(fileDescriptor);
+
+    if (byteCount < ATEN_BLOCK_SIZE || byteCount != (1 + edid[ATEN_EXTENSION_COUNT_OFFSET]) * ATEN_BLOCK_SIZE
+        || edidIsValid(edid) != ATEN_NO_ERROR)
+    {
+        printf("%s: not a valid EDID, skipped\n", path);
+        builder->skippedCount++;
+        return 0;
+    }
+
+    while (*name == '/')
+        name++;
+    nameLength = strlen(name);
+    if (nameLength > 4 && strcmp(name + nameLength - 4, ".bin") == 0)
+        nameLength -= 4;
+    if (nameLength == 0 || nameLength > UINT16_MAX)
+    {
+        printf("%s: can't be named, skipped\n", path);
+        builder->skippedCount++;
+        return 0;
+    }
+
+    entry->name = strndup(name, nameLength);
+    entry->edid = malloc(byteCount);
+    if (entry->name == NULL || entry->edid == NULL)
+    {
+        free(entry->name);
+        free(entry->edid);
+        return -1;
+    }
+    memcpy(entry->edid, edid, byteCount);
+    entry->byteCount = byteCount;
+    entry->digest = edidDigestBytes(edid, byteCount);
+    builder->entryCount++;
+
+    return 0;
+}
+
+
+
+static int packCompareDigests(const void * entry1, const void * entry2)
+{
+    const packEntry_t * first = *(const packEntry_t * const *) entry1;
+    const packEntry_t * second = *(const packEntry_t * const *) entry2;
+
+
+    if (first->digest != second->digest)
+        return first->digest < second->digest ? -1 : 1;
+    if (first->byteCount != second->byteCount)
+        return first->byteCount < second->byteCount ? -1 : 1;
+
+    return memcmp(first->edid, second->edid, first->byteCount);
+}
+
+
+
+static int packCompareNames(const void * entry1, const void * entry2)
+{
+    return strcmp(((const packEntry_t *) entry1)->name, ((const packEntry_t *) entry2)->name);
+}
+
+
+
+int packBuild(const char * directory, const char * path)
+{
+    packBuilder_t builder;
+    packEntry_t ** sorted = NULL;
+    uint8_t * bytes = NULL;
+    char temporaryPath[PATH_MAX + 8];
+    uint32_t slotCount = 1;
+    uint32_t edidCount = 0;
+    size_t namesOffset;
+    size_t edidsOffset;
+    size_t size;
+    int fileDescriptor;
+    int result = -1;
+
+
+    bzero(&builder, sizeof(builder));
+    builder.directory = directory;
+    walkedBuilder = &builder;
+    if (nftw(directory, packAddFile, 32, FTW_PHYS) != 0)
+    {
+        perror(directory);
+        goto end;
+    }
+
+    // names are unique, except for "name" and "name.bin"
+    qsort(builder.entries, builder.entryCount, sizeof(packEntry_t), packCompareNames);
+    for (size_t i = 1; i < builder.entryCount; )
+    {
+        if (strcmp(builder.entries[i].name, builder.entries[i - 1].name) != 0)
+        {
+            i++;
+            continue;
+        }
+        printf("%s: name already used, skipped\n", builder.entries[i].name);
+        free(builder.entries[i].name);
+        free(builder.entries[i].edid);
+        memmove(&builder.entries[i], &builder.entries[i + 1], (builder.entryCount - i - 1) * sizeof(packEntry_t));
+        builder.entryCount--;
+        builder.skippedCount++;
+    }
+
+    while (slotCount < 2 * builder.entryCount)
+        slotCount *= 2;
+
+    // identical EDIDs are stored once: sorted by content, each distinct EDID gets an offset
+    sorted = calloc(builder.entryCount + 1, sizeof(packEntry_t *));
+    if (sorted == NULL)
+        goto end;
+    for (size_t i = 0; i < builder.entryCount; i++)
+        sorted[i] = &builder.entries[i];
+    qsort(sorted, builder.entryCount, sizeof(packEntry_t *), packCompareDigests);
+
+    namesOffset = PACK_HEADER_SIZE + (size_t) slotCount * PACK_SLOT_SIZE;
+    edidsOffset = namesOffset;
+    for (size_t i = 0; i < builder.entryCount; i++)
+        edidsOffset += strlen(builder.entries[i].name);
+
+    size = edidsOffset;
+    for (size_t i = 0; i < builder.entryCount; i++)
+    {
+        if (i > 0 && packCompareDigests(&sorted[i], &sorted[i - 1]) == 0)
+        {
+            sorted[i]->edidOffset = sorted[i - 1]->edidOffset;
+            continue;
+        }
+        sorted[i]->edidOffset = (uint32_t) size;
+        size += sorted[i]->byteCount;
+        edidCount++;
+    }
+    if (size > UINT32_MAX)
+    {
+        printf("%s: pack would be too large\n", path);
+        goto end;
+    }
+
+    bytes = calloc(1, size);
+    if (bytes == NULL)
+        goto end;
+
+    memcpy(bytes, PACK_MAGIC, 8);
+    packPut32(bytes + 8, PACK_VERSION);
+    packPut32(bytes + 12, slotCount);
+    packPut32(bytes + 16, (uint32_t) builder.entryCount);
+    packPut32(bytes + 20, edidCount);
+    packPut32(bytes + 24, PACK_HEADER_SIZE);
+    packPut32(bytes + 28, (uint32_t) namesOffset);
+
+    for (size_t i = 0, nameOffset = namesOffset; i < builder.entryCount; i++)
+    {
+        packEntry_t * entry = &builder.entries[i];
+        size_t nameLength = strlen(entry->name);
+        uint32_t hash = packHash(entry->name, nameLength);
+        uint8_t * slot;
+        uint32_t probe = 0;
+
+
+        do
+            slot = bytes + PACK_HEADER_SIZE + ((hash + probe++) & (slotCount - 1)) * PACK_SLOT_SIZE;
+        while (slot[8] != 0 || slot[9] != 0);
+
+        packPut32(slot, hash);
+        packPut32(slot + 4, (uint32_t) nameOffset);
+        slot[8] = nameLength;
+        slot[9] = nameLength >> 8;
+        packPut32(slot + 10, entry->edidOffset);
+        slot[14] = entry->byteCount / ATEN_BLOCK_SIZE;
+        slot[15] = (entry->byteCount / ATEN_BLOCK_SIZE) >> 8;
+
+        memcpy(bytes + nameOffset, entry->name, nameLength);
+        memcpy(bytes + entry->edidOffset, entry->edid, entry->byteCount);
+        nameOffset += nameLength;
+    }
+
+    // replace any previous pack atomically, jobs may have it mapped
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.XXXXXX", path);
+    fileDescriptor = mkstemp(temporaryPath);
+    if (fileDescriptor < 0)
+    {
+        perror(path);
+        goto end;
+    }
+    if (write(fileDescriptor, bytes, size) != (ssize_t) size || fchmod(fileDescriptor, 0644) != 0)
+    {
+        perror(path);
+        close(fileDescriptor);
+        unlink(temporaryPath);
+        goto end;
+    }
+    if (close(fileDescriptor) != 0 || rename(temporaryPath, path) != 0)
+    {
+        perror(path);
+        unlink(temporaryPath);
+        goto end;
+    }
+
+    printf("%zu names, %u distinct EDIDs, %zu bytes written to '%s'\n", builder.entryCount, edidCount, size, path);
+    result = builder.skippedCount;
+
+end:
+    for (size_t i = 0; i < builder.entryCount; i++)
+    {
+        free(builder.entries[i].name);
+        free(builder.entries[i].edid);
+    }
+    free(builder.entries);
+    free(sorted);
+    free(bytes);
+
+    return result;
+}
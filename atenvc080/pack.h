@@ -0,0 +1,51 @@
+//
+//  pack.h
+//  atenvc080
+//
+
+// Pack of EDIDs: a single file holding deduplicated EDIDs and a hash table of their names,
+// mapped in memory so that an EDID is found without opening or reading any other file.
+//
+// All integers are little endian.
+//   header      magic "AVC080PK", version, slot count (a power of 2), name count, EDID count,
+//               offset of the slots, offset of the names
+//   slots       name hash, name offset, name length, EDID offset, block count; empty if name length is 0
+//   names       names, without terminating NUL
+//   EDIDs       blocks of each distinct EDID
+
+#ifndef pack_h
+#define pack_h
+
+#include "aten.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+
+
+
+typedef struct
+{
+    char path[PATH_MAX];
+    const uint8_t * bytes;          // NULL when no pack is open
+    size_t size;
+    uint32_t slotCount;
+    uint32_t nameCount;
+    uint32_t edidCount;
+    dev_t device;                   // of the file mapped, to notice it was replaced
+    ino_t inode;
+    time_t modificationTime;
+} pack_t;
+
+
+
+void packInit(pack_t * pack);
+int packOpen(pack_t * pack, const char * path);            // returns -1 if not a valid pack, keeps it mapped if unchanged
+void packClose(pack_t * pack);
+// returns the EDID blocks and their count, NULL if not found
+const uint8_t * packLookup(const pack_t * pack, const char * name, unsigned * blockCount);
+int packBuild(const char * directory, const char * path);  // returns the count of skipped files, -1 on error
+
+#endif /* pack_h */
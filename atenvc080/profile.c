@@ -0,0 +1,372 @@
+//
+//  profile.c
+//  atenvc080
+//
+
+#include "profile.h"
+#include "aten.h"
+#include "cache.h"
+#include "edid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+
+
+#define PROFILE_MARGIN_FACTOR   2           // measured p99 is doubled,
+#define PROFILE_MARGIN          50          // then given as many more milliseconds, for scheduling and adapter jitter
+
+
+
+static const char * profileCommandNames[PROFILE_COMMAND_COUNT] =
+{
+    [PROFILE_IDENTIFY] = "identify",
+    [PROFILE_SWITCH] = "switch",
+    [PROFILE_READ] = "read",
+    [PROFILE_EXTENSION] = "extension",
+    [PROFILE_WRITE] = "write",
+    [PROFILE_CEC] = "cec",
+};
+
+typedef struct
+{
+    uintmax_t * samples[PROFILE_COMMAND_COUNT];
+    unsigned counts[PROFILE_COMMAND_COUNT];
+    unsigned capacity;              // of each command, writes and CEC take several samples per round
+} profile_samples_t;
+
+
+
+const char * profileCommandName(profile_command_t command)
+{
+    return profileCommandNames[command];
+}
+
+
+
+static void profileAddSample(profile_samples_t * samples, profile_command_t command, uintmax_t milliseconds)
+{
+    if (samples->counts[command] < samples->capacity)
+        samples->samples[command][samples->counts[command]++] = milliseconds;
+}
+
+
+
+static int profileCompareSamples(const void * sample1, const void * sample2)
+{
+    uintmax_t milliseconds1 = *(const uintmax_t *) sample1;
+    uintmax_t milliseconds2 = *(const uintmax_t *) sample2;
+
+
+    return (milliseconds1 > milliseconds2) - (milliseconds1 < milliseconds2);
+}
+
+
+
+// nearest rank percentiles
+static void profileSummarize(uintmax_t * samples, unsigned count, profile_timing_t * timing)
+{
+    timing->sampleCount = count;
+    if (count == 0)
+        return;
+
+    qsort(samples, count, sizeof(uintmax_t), profileCompareSamples);
+    timing->p50 = samples[(count * 50 + 99) / 100 - 1];
+    timing->p90 = samples[(count * 90 + 99) / 100 - 1];
+    timing->p99 = samples[(count * 99 + 99) / 100 - 1];
+    timing->max = samples[count - 1];
+}
+
+
+
+// Wait, from start, for the device to send expected, or any byte if expected is -1.
+// Returns ATEN_READ_ERROR as soon as the device hung up.
+static int profileAwaitByte(serial_t serialDevice, int expected, uintmax_t start, uintmax_t milliseconds, int * byte)
+{
+    uintmax_t deadline = start + milliseconds;
+    uintmax_t now;
+    serial_status_t status;
+
+
+    while ((now = monotonicMilliseconds()) < deadline)
+    {
+        if ((status = serialWaitForAvailableBytes(serialDevice, deadline - now)) == serialError)
+            return ATEN_READ_ERROR;
+        if (status != serialOK)
+            continue;
+
+        *byte = serialReadByte(serialDevice);
+        if (expected < 0 || *byte == expected)
+            return ATEN_NO_ERROR;
+    }
+
+    return ATEN_TIMEOUT;
+}
+
+
+
+// A command that gets no acknowledgement is timed by the delay it adds to the identification that follows it,
+// the device handling commands one after the other.
+static int profileMeasureUnacknowledged(serial_t serialDevice, uint8_t command, int deviceType, uintmax_t identifyTime, uintmax_t * milliseconds)
+{
+    uintmax_t start;
+    uintmax_t elapsed;
+    int byte;
+    int status;
+
+
+    serialClearPendingBytes(serialDevice);      // dismiss errors
+    start = monotonicMilliseconds();
+    if (serialWriteByte(serialDevice, command) != serialOK || serialWriteByte(serialDevice, 0x0b) != serialOK)
+        return ATEN_WRITE_ERROR;
+    if ((status = profileAwaitByte(serialDevice, deviceType, start, ATEN_SETTLE_TIME + ATEN_REPLY_TIMEOUT, &byte)) != ATEN_NO_ERROR)
+        return status;
+
+    elapsed = monotonicMilliseconds() - start;
+    *milliseconds = elapsed > identifyTime ? elapsed - identifyTime : 0;
+
+    return ATEN_NO_ERROR;
+}
+
+
+
+int profileCalibrate(serial_t serialDevice, int position, unsigned sampleCount, profile_t * profile)
+{
+    profile_samples_t samples;
+    uint8_t edid[ATEN_MAX_EDID_SIZE];
+    int extensionBlockCount = 0;
+    int haveEDID = 0;
+    uintmax_t start;
+    uintmax_t milliseconds;
+    int byte;
+    int status = ATEN_NO_ERROR;
+
+
+    bzero(profile, sizeof(profile_t));
+    profile->deviceType = -1;
+    if (position < ATEN_SET_DEFAULT || position > ATEN_SET_3 || sampleCount < 1)
+        return ATEN_INVALID;
+
+    bzero(&samples, sizeof(samples));
+    samples.capacity = 3 * sampleCount;
+    for (int command = 0; command < PROFILE_COMMAND_COUNT; command++)
+    {
+        if ((samples.samples[command] = calloc(samples.capacity, sizeof(uintmax_t))) == NULL)
+            goto readError;
+    }
+
+    // identification, whose median is then taken out of the times of commands without acknowledgement
+    for (unsigned sample = 0; sample < sampleCount; sample++)
+    {
+        serialClearPendingBytes(serialDevice);      // dismiss errors
+        start = monotonicMilliseconds();
+        if (serialWriteByte(serialDevice, 0x0b) != serialOK)
+            goto writeError;
+        if ((status = profileAwaitByte(serialDevice, -1, start, ATEN_REPLY_TIMEOUT, &byte)) != ATEN_NO_ERROR)
+            goto end;
+        profileAddSample(&samples, PROFILE_IDENTIFY, monotonicMilliseconds() - start);
+        profile->deviceType = byte;
+    }
+    profileSummarize(samples.samples[PROFILE_IDENTIFY], samples.counts[PROFILE_IDENTIFY], &profile->timings[PROFILE_IDENTIFY]);
+
+    // reads of the selected set, with its extension
+    for (unsigned sample = 0; sample < sampleCount; sample++)
+    {
+        serialClearPendingBytes(serialDevice);      // dismiss errors
+        start = monotonicMilliseconds();
+        if (serialWriteByte(serialDevice, 0x0c) != serialOK)
+            goto writeError;
+        if ((status = profileAwaitByte(serialDevice, 0x05, start, ATEN_ACK_TIMEOUT, &byte)) != ATEN_NO_ERROR)
+            goto end;
+        profileAddSample(&samples, PROFILE_READ, monotonicMilliseconds() - start);
+
+        bzero(edid, 2 * ATEN_BLOCK_SIZE);
+        if (serialReadBytes(serialDevice, edid, ATEN_BLOCK_SIZE, ATEN_BLOCK_TIMEOUT) != serialOK)
+            goto readError;
+        extensionBlockCount = edid[ATEN_EXTENSION_COUNT_OFFSET];
+        if (extensionBlockCount > 0)
+        {
+            start = monotonicMilliseconds();
+            if (serialWriteByte(serialDevice, 0x05) != serialOK)
+                goto writeError;
+            if (serialReadBytes(serialDevice, edid + ATEN_BLOCK_SIZE, ATEN_BLOCK_SIZE, ATEN_BLOCK_TIMEOUT) != serialOK)
+                goto readError;
+            profileAddSample(&samples, PROFILE_EXTENSION, monotonicMilliseconds() - start);
+        }
+    }
+    haveEDID = (extensionBlockCount <= 1 && edidIsValid(edid) == ATEN_NO_ERROR);
+
+    // writes of the same EDID back, the acknowledgement of the command and of each block are all samples
+    for (unsigned sample = 0; haveEDID && sample < sampleCount; sample++)
+    {
+        serialClearPendingBytes(serialDevice);      // dismiss errors
+        start = monotonicMilliseconds();
+        if (serialWriteByte(serialDevice, 0x0a) != serialOK)
+            goto writeError;
+        if ((status = profileAwaitByte(serialDevice, 0x05, start, ATEN_ACK_TIMEOUT, &byte)) != ATEN_NO_ERROR)
+            goto end;
+        profileAddSample(&samples, PROFILE_WRITE, monotonicMilliseconds() - start);
+
+        for (int block = 0; block <= extensionBlockCount; block++)
+        {
+            start = monotonicMilliseconds();
+            if (serialWriteBytes(serialDevice, edid + block * ATEN_BLOCK_SIZE, ATEN_BLOCK_SIZE) != serialOK)
+                goto writeError;
+            if ((status = profileAwaitByte(serialDevice, 0x05, start, ATEN_ACK_TIMEOUT, &byte)) != ATEN_NO_ERROR)
+                goto end;
+            profileAddSample(&samples, PROFILE_WRITE, monotonicMilliseconds() - start);
+        }
+    }
+
+    // CEC connections and disconnections, ending disconnected
+    for (unsigned sample = 0; sample < sampleCount; sample++)
+    {
+        for (uint8_t command = 0x08; command <= 0x09; command++)
+        {
+            if ((status = profileMeasureUnacknowledged(serialDevice, command, profile->deviceType, profile->timings[PROFILE_IDENTIFY].p50, &milliseconds)) != ATEN_NO_ERROR)
+                goto end;
+            profileAddSample(&samples, PROFILE_CEC, milliseconds);
+        }
+    }
+
+    // switches through all sets, then back to the selected one
+    for (unsigned sample = 0; sample < sampleCount; sample++)
+    {
+        if ((status = profileMeasureUnacknowledged(serialDevice, 0x01 + sample % 4, profile->deviceType, profile->timings[PROFILE_IDENTIFY].p50, &milliseconds)) != ATEN_NO_ERROR)
+            goto end;
+        profileAddSample(&samples, PROFILE_SWITCH, milliseconds);
+    }
+    if ((status = profileMeasureUnacknowledged(serialDevice, 0x01 + position, profile->deviceType, 0, &milliseconds)) != ATEN_NO_ERROR)
+        goto end;
+
+    for (int command = PROFILE_IDENTIFY + 1; command < PROFILE_COMMAND_COUNT; command++)
+        profileSummarize(samples.samples[command], samples.counts[command], &profile->timings[command]);
+
+    status = ATEN_NO_ERROR;
+    goto end;
+
+readError:
+    status = ATEN_READ_ERROR;
+    goto end;
+
+writeError:
+    status = ATEN_WRITE_ERROR;
+    goto end;
+
+end:
+    for (int command = 0; command < PROFILE_COMMAND_COUNT; command++)
+        free(samples.samples[command]);
+
+    return status;
+}
+
+
+
+int profileLoad(const char * devicePath, profile_t * profile)
+{
+    char path[PATH_MAX];
+    char line[256];
+    char name[32];
+    profile_timing_t timing;
+    FILE * file;
+    int command;
+
+
+    if (cacheDevicePath(path, devicePath, "profile") != 0 || (file = fopen(path, "r")) == NULL)
+        return -1;
+
+    bzero(profile, sizeof(profile_t));
+    profile->deviceType = -1;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (sscanf(line, "type %i", &profile->deviceType) == 1)
+            continue;
+        if (sscanf(line, "%31s %u %ju %ju %ju %ju", name, &timing.sampleCount, &timing.p50, &timing.p90, &timing.p99, &timing.max) != 6)
+            continue;
+        for (command = 0; command < PROFILE_COMMAND_COUNT; command++)
+        {
+            if (strcmp(name, profileCommandNames[command]) == 0)
+                profile->timings[command] = timing;
+        }
+    }
+    fclose(file);
+
+    return 0;
+}
+
+
+
+int profileStore(const char * devicePath, const profile_t * profile)
+{
+    char path[PATH_MAX];
+    char temporaryPath[PATH_MAX + 8];
+    FILE * file;
+    int failed;
+
+
+    if (cacheDevicePath(path, devicePath, "profile") != 0)
+        return -1;
+
+    // readers never see a partial profile
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.%d", path, (int) getpid());
+    if ((file = fopen(temporaryPath, "w")) == NULL)
+        return -1;
+
+    fprintf(file, "# command samples p50 p90 p99 max, in milliseconds\n");
+    fprintf(file, "type 0x%02x\n", profile->deviceType);
+    for (int command = 0; command < PROFILE_COMMAND_COUNT; command++)
+    {
+        const profile_timing_t * timing = &profile->timings[command];
+
+        if (timing->sampleCount > 0)
+            fprintf(file, "%s %u %ju %ju %ju %ju\n", profileCommandNames[command], timing->sampleCount, timing->p50, timing->p90, timing->p99, timing->max);
+    }
+
+    failed = ferror(file);
+    if (fclose(file) != 0 || failed || rename(temporaryPath, path) != 0)
+    {
+        unlink(temporaryPath);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+// p99 with margin, or the policy's own wait if not measured
+static uintmax_t profileWait(const profile_timing_t * timing, uintmax_t wait)
+{
+    return timing->sampleCount > 0 ? timing->p99 * PROFILE_MARGIN_FACTOR + PROFILE_MARGIN : wait;
+}
+
+
+
+void profileApply(const profile_t * profile)
+{
+    const profile_timing_t * timings = profile->timings;
+    aten_policy_t policy;
+    uintmax_t cecWait;
+
+
+    // attempts, backoff and deadline are kept
+    policy = *atenGetPolicy(ATEN_POLICY_SWITCH);
+    cecWait = profileWait(&timings[PROFILE_CEC], policy.wait);
+    policy.wait = profileWait(&timings[PROFILE_SWITCH], policy.wait);
+    if (cecWait > policy.wait)
+        policy.wait = cecWait;
+    atenSetPolicy(ATEN_POLICY_SWITCH, &policy);
+
+    policy = *atenGetPolicy(ATEN_POLICY_READ);
+    policy.wait = profileWait(&timings[PROFILE_READ], policy.wait);
+    atenSetPolicy(ATEN_POLICY_READ, &policy);
+
+    policy = *atenGetPolicy(ATEN_POLICY_WRITE);
+    policy.wait = profileWait(&timings[PROFILE_WRITE], policy.wait);
+    atenSetPolicy(ATEN_POLICY_WRITE, &policy);
+
+    // display reads depend on the display, not measured, and keep their policy
+}
@@ -0,0 +1,59 @@
+//
+//  profile.h
+//  atenvc080
+//
+
+// Latency profile of a device: response times of its commands measured on the device and its serial adapter,
+// kept in its cache directory (see cache.h) and turned into the wait policies of aten.h on the following runs.
+//
+// The profile is a text file, one line per command: name, sample count, then p50, p90, p99 and maximum in
+// milliseconds. A 'type' line holds the device type replied to identification.
+
+#ifndef profile_h
+#define profile_h
+
+#include "mac.h"
+
+#include <stdint.h>
+
+
+
+typedef enum
+{
+    PROFILE_IDENTIFY = 0,           // 0x0b until its reply
+    PROFILE_SWITCH,                 // 0x01-0x04, measured as the delay it adds to a following identification
+    PROFILE_READ,                   // 0x0c until its acknowledgement
+    PROFILE_EXTENSION,              // 0x05 until the extension block is received
+    PROFILE_WRITE,                  // 0x0a, then each block, until its acknowledgement
+    PROFILE_CEC,                    // 0x08 and 0x09, measured as switches are
+    PROFILE_COMMAND_COUNT,
+} profile_command_t;
+
+typedef struct
+{
+    unsigned sampleCount;           // 0 if not measured
+    uintmax_t p50;
+    uintmax_t p90;
+    uintmax_t p99;
+    uintmax_t max;
+} profile_timing_t;
+
+typedef struct
+{
+    int deviceType;
+    profile_timing_t timings[PROFILE_COMMAND_COUNT];
+} profile_t;
+
+
+
+const char * profileCommandName(profile_command_t command);
+
+// The selected set is read and written back with the same content, and CEC is left disconnected.
+// Returns an ATEN_* status.
+int profileCalibrate(serial_t serialDevice, int position, unsigned sampleCount, profile_t * profile);
+
+int profileLoad(const char * devicePath, profile_t * profile);         // returns -1 if the device has no profile
+int profileStore(const char * devicePath, const profile_t * profile);
+void profileApply(const profile_t * profile);                          // to the policies of aten.h, with a margin, but display reads
+
+#endif /* profile_h */
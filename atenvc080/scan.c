@@ -0,0 +1,307 @@
+//
+//  scan.c
+//  atenvc080
+//
+
+#if !defined(__APPLE__)
+#define _GNU_SOURCE                             // nftw() with glibc
+#endif
+
+#include "scan.h"
+#include "edid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+typedef struct
+{
+    char * path;
+    int readable;
+    int valid;
+    uint64_t digest;                // of the blocks present in the file
+    edid_info_t info;
+} scanEntry_t;
+
+typedef struct
+{
+    scanEntry_t * entries;
+    size_t entryCount;
+    size_t capacity;
+    size_t next;                    // next entry to be scanned by a thread
+    pthread_mutex_t lock;
+} scanLibrary_t;
+
+
+
+static scanLibrary_t * walkedLibrary;      // nftw() has no context argument
+
+
+
+static int scanAddFile(const char * path, const struct stat * status, int type, struct FTW * ftw)
+{
+    scanLibrary_t * library = walkedLibrary;
+
+
+    if (type != FTW_F || !S_ISREG(status->st_mode))
+        return 0;
+
+    if (library->entryCount == library->capacity)
+    {
+        size_t capacity = library->capacity == 0 ? 256 : 2 * library->capacity;
+        scanEntry_t * entries = realloc(library->entries, capacity * sizeof(scanEntry_t));
+
+
+        if (entries == NULL)
+            return -1;
+        library->entries = entries;
+        library->capacity = capacity;
+    }
+
+    bzero(&library->entries[library->entryCount], sizeof(scanEntry_t));
+    library->entries[library->entryCount].path = strdup(path);
+    if (library->entries[library->entryCount].path == NULL)
+        return -1;
+    library->entryCount++;
+
+    return 0;
+}
+
+
+
+static void scanFile(scanEntry_t * entry)
+{
+    struct stat status;
+    const uint8_t * bytes;
+    int fileDescriptor;
+
+
+    fileDescriptor = open(entry->path, O_RDONLY);
+    if (fileDescriptor < 0)
+        return;
+
+    if (fstat(fileDescriptor, &status) != 0)
+    {
+        close(fileDescriptor);
+        return;
+    }
+
+    if (status.st_size == 0)
+    {
+        // can't be mapped, reported as truncated
+        close(fileDescriptor);
+        entry->readable = 1;
+        edidValidate(NULL, 0, &entry->info);
+        return;
+    }
+
+    bytes = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor);
+    if (bytes == MAP_FAILED)
+        return;
+
+    entry->readable = 1;
+    entry->valid = (edidValidate(bytes, status.st_size, &entry->info) == ATEN_NO_ERROR);
+    entry->digest = edidDigestBytes(bytes, entry->info.blockCount * ATEN_BLOCK_SIZE);
+
+    munmap((void *) bytes, status.st_size);
+}
+
+
+
+static void * scanThread(void * context)
+{
+    scanLibrary_t * library = context;
+    size_t index;
+
+
+    for (;;)
+    {
+        pthread_mutex_lock(&library->lock);
+        index = library->next++;
+        pthread_mutex_unlock(&library->lock);
+
+        if (index >= library->entryCount)
+            return NULL;
+
+        scanFile(&library->entries[index]);
+    }
+}
+
+
+
+static int scanComparePaths(const void * entry1, const void * entry2)
+{
+    return strcmp(((const scanEntry_t *) entry1)->path, ((const scanEntry_t *) entry2)->path);
+}
+
+
+
+static int scanCompareDigests(const void * entry1, const void * entry2)
+{
+    const scanEntry_t * first = *(const scanEntry_t * const *) entry1;
+    const scanEntry_t * second = *(const scanEntry_t * const *) entry2;
+
+
+    if (first->digest != second->digest)
+        return first->digest < second->digest ? -1 : 1;
+
+    return strcmp(first->path, second->path);
+}
+
+
+
+static void scanPrintEntry(const scanEntry_t * entry)
+{
+    const edid_info_t * info = &entry->info;
+    const char * status = "ok";
+    char serial[16];
+
+
+    if (!entry->readable)
+    {
+        printf("%-16s %6s %-3s %-6s %-13s %-30s %s\n", "-", "-", "-", "-", "-", "can't read", entry->path);
+        return;
+    }
+
+    if (!entry->valid)
+    {
+        // the first error, warnings don't make an EDID invalid
+        for (size_t i = 0; i < info->issueCount && i < EDID_MAX_ISSUES; i++)
+        {
+            if (info->issues[i].error != EDID_UNKNOWN_EXTENSION)
+            {
+                status = edidErrorString(info->issues[i].error);
+                break;
+            }
+        }
+    }
+
+    if (info->blockCount == 0)
+    {
+        printf("%-16s %6d %-3s %-6s %-13s %-30s %s\n", "-", 0, "-", "-", "-", status, entry->path);
+        return;
+    }
+
+    if (info->serialText[0] != '\0')
+        snprintf(serial, sizeof(serial), "%s", info->serialText);
+    else
+        snprintf(serial, sizeof(serial), "%u", info->serialNumber);
+
+    printf("%016llx %6d %-3s 0x%04x %-13s %-30s %s\n", (unsigned long long) entry->digest, info->blockCount,
+           info->manufacturer, info->product, serial, status, entry->path);
+}
+
+
+
+// Returns the count of duplicated EDIDs, valid or not.
+static size_t scanPrintDuplicates(scanLibrary_t * library)
+{
+    const scanEntry_t ** sorted;
+    size_t groupCount = 0;
+
+
+    sorted = calloc(library->entryCount, sizeof(scanEntry_t *));
+    if (sorted == NULL)
+        return 0;
+
+    for (size_t i = 0; i < library->entryCount; i++)
+        sorted[i] = &library->entries[i];
+    qsort(sorted, library->entryCount, sizeof(scanEntry_t *), scanCompareDigests);
+
+    for (size_t i = 0; i < library->entryCount; )
+    {
+        size_t end = i + 1;
+
+
+        while (end < library->entryCount && sorted[end]->digest == sorted[i]->digest)
+            end++;
+
+        if (end - i > 1 && sorted[i]->info.blockCount > 0)
+        {
+            printf("duplicates %016llx:\n", (unsigned long long) sorted[i]->digest);
+            for (size_t j = i; j < end; j++)
+                printf("    %s\n", sorted[j]->path);
+            groupCount++;
+        }
+        i = end;
+    }
+
+    free(sorted);
+
+    return groupCount;
+}
+
+
+
+int scanLibrary(const char * directory)
+{
+    scanLibrary_t library;
+    pthread_t threads[SCAN_MAX_THREADS];
+    long threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t invalidCount = 0;
+    size_t duplicateCount;
+    int result = 0;
+
+
+    bzero(&library, sizeof(library));
+    pthread_mutex_init(&library.lock, NULL);
+
+    walkedLibrary = &library;
+    if (nftw(directory, scanAddFile, 32, FTW_PHYS) != 0)
+    {
+        perror(directory);
+        result = -1;
+        goto end;
+    }
+
+    if (threadCount < 1)
+        threadCount = 1;
+    if (threadCount > SCAN_MAX_THREADS)
+        threadCount = SCAN_MAX_THREADS;
+    if ((size_t) threadCount > library.entryCount)
+        threadCount = library.entryCount;
+
+    for (long i = 0; i < threadCount; i++)
+    {
+        if (pthread_create(&threads[i], NULL, scanThread, &library) != 0)
+        {
+            threadCount = i;
+            break;
+        }
+    }
+    scanThread(&library);       // lend a hand, and scan alone if no thread could be created
+    for (long i = 0; i < threadCount; i++)
+        pthread_join(threads[i], NULL);
+
+    qsort(library.entries, library.entryCount, sizeof(scanEntry_t), scanComparePaths);
+
+    printf("%-16s %6s %-3s %-6s %-13s %-30s %s\n", "digest", "blocks", "mfr", "prod", "serial", "status", "path");
+    for (size_t i = 0; i < library.entryCount; i++)
+    {
+        scanPrintEntry(&library.entries[i]);
+        if (!library.entries[i].valid)
+            invalidCount++;
+    }
+
+    duplicateCount = scanPrintDuplicates(&library);
+    printf("%zu files, %zu valid, %zu invalid, %zu duplicated EDIDs\n", library.entryCount,
+           library.entryCount - invalidCount, invalidCount, duplicateCount);
+    result = (int) invalidCount;
+
+end:
+    for (size_t i = 0; i < library.entryCount; i++)
+        free(library.entries[i].path);
+    free(library.entries);
+    pthread_mutex_destroy(&library.lock);
+
+    return result;
+}
@@ -0,0 +1,20 @@
+//
+//  scan.h
+//  atenvc080
+//
+
+// Validation and index of a library of EDID files: every regular file under a directory is mapped
+// and validated by a pool of threads, then an index line is printed per file, followed by duplicates.
+
+#ifndef scan_h
+#define scan_h
+
+
+
+#define SCAN_MAX_THREADS        16
+
+
+
+int scanLibrary(const char * directory);       // returns the count of invalid files, -1 on error
+
+#endif /* scan_h */
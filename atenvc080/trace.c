@@ -0,0 +1,119 @@
+//
+//  trace.c
+//  atenvc080
+//
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+static int traceDescriptor = -1;
+static pid_t traceOwner;        // process that opened the trace, it terminates the JSON array
+
+
+
+static void traceWrite(const char * format, ...)
+{
+    char line[512];
+    va_list arguments;
+    int length;
+
+
+    va_start(arguments, format);
+    length = vsnprintf(line, sizeof(line), format, arguments);
+    va_end(arguments);
+
+    if (length <= 0 || length >= sizeof(line))
+        return;
+
+    write(traceDescriptor, line, length);       // dismiss errors, tracing must not fail the run
+}
+
+
+
+int traceOpen(const char * path)
+{
+    traceDescriptor = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+    if (traceDescriptor == -1)
+        return -1;
+
+    traceOwner = getpid();
+    traceWrite("[\n");
+    traceProcessName("atenvc080");
+
+    return 0;
+}
+
+
+
+void traceClose(void)
+{
+    if (traceDescriptor == -1)
+        return;
+
+    // every event is followed by a comma, end with one that is not
+    if (getpid() == traceOwner)
+        traceWrite("{\"name\":\"trace_end\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%ju,\"pid\":%d,\"tid\":%d}\n]\n", traceTime(), (int) traceOwner, (int) traceOwner);
+
+    close(traceDescriptor);
+    traceDescriptor = -1;
+}
+
+
+
+// names are device paths or literals, they need no escaping beyond quotes and backslashes
+void traceProcessName(const char * name)
+{
+    char escapedName[256];
+    size_t length = 0;
+
+
+    if (traceDescriptor == -1)
+        return;
+
+    for (; *name != '\0' && length < sizeof(escapedName) - 2; name++)
+    {
+        if (*name == '"' || *name == '\\')
+            escapedName[length++] = '\\';
+        escapedName[length++] = *name;
+    }
+    escapedName[length] = '\0';
+
+    traceWrite("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", (int) getpid(), (int) getpid(), escapedName);
+}
+
+
+
+uintmax_t traceTime(void)
+{
+    struct timespec now;
+
+
+    if (traceDescriptor == -1)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uintmax_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+
+// a complete event, from start to now
+void traceEvent(const char * category, const char * name, uintmax_t start, const char * argumentName, intmax_t argument)
+{
+    uintmax_t now = traceTime();
+
+
+    if (traceDescriptor == -1 || start == 0)       // start is 0 if the trace was opened during the event
+        return;
+
+    traceWrite("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%ju,\"dur\":%ju,\"pid\":%d,\"tid\":%d,\"args\":{\"%s\":%jd}},\n",
+               name, category, start, now - start, (int) getpid(), (int) getpid(), argumentName, argument);
+}
@@ -0,0 +1,23 @@
+//
+//  trace.h
+//  atenvc080
+//
+
+// Timeline of serial I/O, waits, pauses and device operations, in Chrome trace event format
+// (JSON array of complete events), to be opened with Perfetto or chrome://tracing.
+// Workers share the trace file, each event being appended with a single write.
+
+#ifndef trace_h
+#define trace_h
+
+#include <stdint.h>
+
+
+
+int traceOpen(const char * path);               // returns -1 on error
+void traceClose(void);
+void traceProcessName(const char * name);
+uintmax_t traceTime(void);                      // in microseconds, 0 when not tracing
+void traceEvent(const char * category, const char * name, uintmax_t start, const char * argumentName, intmax_t argument);
+
+#endif /* trace_h */
@@ -0,0 +1,142 @@
+//
+//  vc080.hpp
+//  atenvc080
+//
+
+// C++20 coroutines over the engine of engine.h, for programs driving many devices from one thread:
+//
+//     vc080::Task provision(vc080::Port & port, uint8_t * edid)
+//     {
+//         if (co_await port.selectSet(ATEN_SET_2) != ATEN_NO_ERROR)
+//             co_return;
+//         co_await port.write(edid);
+//     }
+//
+//     vc080::Port port1(serialDevice1), port2(serialDevice2);
+//     provision(port1, edid);
+//     provision(port2, edid);
+//     vc080::run({ &port1, &port2 });
+//
+// A coroutine runs until its first co_await, then is resumed by the engine as the operation ends, from run() or
+// from whichever event loop calls engineInput() and engineTimer() on the ports. co_await gives the ATEN_* status.
+// A port runs one operation at a time, and must outlive the coroutines using it.
+
+#ifndef vc080_hpp
+#define vc080_hpp
+
+#include "engine.h"
+
+#include <coroutine>
+#include <exception>
+#include <vector>
+
+
+
+namespace vc080
+{
+    // Fire and forget coroutine, started at once and destroyed when it returns.
+    struct Task
+    {
+        struct promise_type
+        {
+            Task get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+
+
+
+    class Port
+    {
+    public:
+        explicit Port(serial_t serialDevice)
+        {
+            enginePortInit(&port, serialDevice, resume, this);
+        }
+
+        Port(const Port &) = delete;                // the engine keeps a pointer to the port
+        Port & operator=(const Port &) = delete;
+
+        engine_port_t * engine() { return &port; }
+        int deviceType() const { return port.deviceType; }
+
+        // Awaitable engine operation, start is called with the engine port when the coroutine suspends.
+        template <typename Start>
+        class Operation
+        {
+        public:
+            Operation(Port & port, Start start) : port(port), start(start) {}
+
+            bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                port.continuation = handle;
+                status = start(&port.port);
+                started = (status == ATEN_NO_ERROR);
+                if (!started)
+                    port.continuation = nullptr;
+
+                return started;             // resumed at once if the operation couldn't start
+            }
+
+            int await_resume() const noexcept { return started ? port.port.status : status; }
+
+        private:
+            Port & port;
+            Start start;
+            int status = ATEN_NO_ERROR;
+            bool started = false;
+        };
+
+        template <typename Start>
+        Operation<Start> operation(Start start) { return Operation<Start>(*this, start); }
+
+        auto identify() { return operation([](engine_port_t * port) { return engineIdentify(port); }); }
+        auto selectSet(aten_set_id setID) { return operation([setID](engine_port_t * port) { return engineSelectSet(port, setID); }); }
+        auto readSet(uint8_t * edid) { return operation([edid](engine_port_t * port) { return engineReadSet(port, edid); }); }
+        auto readDisplay(uint8_t * edid) { return operation([edid](engine_port_t * port) { return engineReadDisplay(port, edid); }); }
+        auto write(uint8_t * edid) { return operation([edid](engine_port_t * port) { return engineWriteEDID(port, edid); }); }
+        auto cecConnect() { return operation([](engine_port_t * port) { return engineCECConnect(port); }); }
+        auto cecDisconnect() { return operation([](engine_port_t * port) { return engineCECDisconnect(port); }); }
+        auto updateFirmware(const uint8_t * data, size_t length, aten_firmware_progress_t * progress = nullptr,
+                            atenProgressFunction_t progressFunction = nullptr, void * context = nullptr)
+        {
+            return operation([=](engine_port_t * port) { return engineUpdateFirmware(port, data, length, progress, progressFunction, context); });
+        }
+
+    private:
+        // done function of the engine port
+        static void resume(engine_port_t *, void * context)
+        {
+            Port * self = static_cast<Port *>(context);
+            std::coroutine_handle<> continuation = self->continuation;
+
+
+            self->continuation = nullptr;
+            if (continuation)
+                continuation.resume();
+        }
+
+        engine_port_t port;
+        std::coroutine_handle<> continuation;
+    };
+
+
+
+    // until no operation is running on the ports
+    inline void run(const std::vector<Port *> & ports)
+    {
+        std::vector<engine_port_t *> enginePorts;
+
+
+        for (Port * port : ports)
+            enginePorts.push_back(port->engine());
+        engineRun(enginePorts.data(), enginePorts.size());
+    }
+}
+
+#endif /* vc080_hpp */
@@ -0,0 +1,393 @@
+//
+//  workers.c
+//  atenvc080
+//
+
+#include "workers.h"
+#include "mac.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glob.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+
+static volatile sig_atomic_t stopWatching = 0;
+
+
+
+static void workerFlushLine(worker_t * worker)
+{
+    if (worker->lineLength == 0)
+        return;
+
+    printf("%s: %.*s\n", worker->path, (int) worker->lineLength, worker->line);
+    worker->lineLength = 0;
+}
+
+
+
+static void workerRelayOutput(worker_t * worker)
+{
+    char bytes[1024];
+    ssize_t byteCount;
+
+
+    byteCount = read(worker->output, bytes, sizeof(bytes));
+    if (byteCount < 0 && errno == EINTR)
+        return;
+
+    if (byteCount <= 0)
+    {
+        // end of output, the worker is exiting
+        workerFlushLine(worker);
+        close(worker->output);
+        worker->output = -1;
+
+        if (waitpid(worker->pid, &worker->status, 0) == -1 || !WIFEXITED(worker->status))
+            worker->status = 1;
+        else
+            worker->status = WEXITSTATUS(worker->status);
+        worker->pid = -1;
+        return;
+    }
+
+    for (ssize_t i = 0; i < byteCount; i++)
+    {
+        if (bytes[i] == '\n')
+            workerFlushLine(worker);
+        else
+        {
+            if (worker->lineLength == WORKER_MAX_LINE)
+                workerFlushLine(worker);
+            worker->line[worker->lineLength++] = bytes[i];
+        }
+    }
+}
+
+
+
+int workerStart(worker_t * worker, const char * devicePath, workerFunction_t function, void * context)
+{
+    int descriptors[2];
+
+
+    snprintf(worker->path, sizeof(worker->path), "%s", devicePath);
+    worker->pid = -1;
+    worker->output = -1;
+    worker->lineLength = 0;
+    worker->status = 1;
+
+    if (pipe(descriptors) == -1)
+        return -1;
+
+    fflush(stdout);     // don't have buffered output printed twice
+    fflush(stderr);
+
+    worker->pid = fork();
+    if (worker->pid == -1)
+    {
+        close(descriptors[0]);
+        close(descriptors[1]);
+        return -1;
+    }
+
+    if (worker->pid == 0)
+    {
+        close(descriptors[0]);
+        signal(SIGINT, SIG_IGN);        // ^C at the terminal reaches workers too, they finish their device first
+        dup2(descriptors[1], STDOUT_FILENO);
+        dup2(descriptors[1], STDERR_FILENO);
+        close(descriptors[1]);
+        setvbuf(stdout, NULL, _IOLBF, 0);
+
+        exit(function(devicePath, context));
+    }
+
+    close(descriptors[1]);
+    worker->output = descriptors[0];
+
+    return 0;
+}
+
+
+
+// Relays the output of workers, also waiting for descriptor to be readable, unless it is -1.
+static size_t workersPoll(worker_t * workers, size_t workerCount, int descriptor, int * readable, int milliseconds)
+{
+    struct pollfd * pollDescriptors;
+    size_t * indexes;
+    size_t pollCount = 0;
+    size_t runningCount = 0;
+
+
+    *readable = 0;
+    pollDescriptors = calloc(workerCount + 1, sizeof(struct pollfd));
+    indexes = calloc(workerCount + 1, sizeof(size_t));
+    if (pollDescriptors == NULL || indexes == NULL)
+    {
+        free(pollDescriptors);
+        free(indexes);
+        return workerCount;
+    }
+
+    for (size_t i = 0; i < workerCount; i++)
+    {
+        if (workers[i].output == -1)
+            continue;
+
+        pollDescriptors[pollCount].fd = workers[i].output;
+        pollDescriptors[pollCount].events = POLLIN;
+        indexes[pollCount++] = i;
+    }
+
+    if (descriptor != -1)
+    {
+        pollDescriptors[pollCount].fd = descriptor;
+        pollDescriptors[pollCount].events = POLLIN;
+        indexes[pollCount++] = workerCount;
+    }
+
+    if (pollCount > 0 && poll(pollDescriptors, (nfds_t) pollCount, milliseconds) > 0)
+    {
+        for (size_t i = 0; i < pollCount; i++)
+        {
+            if (pollDescriptors[i].revents == 0)
+                continue;
+            if (indexes[i] == workerCount)
+                *readable = 1;
+            else
+                workerRelayOutput(&workers[indexes[i]]);
+        }
+    }
+    fflush(stdout);
+
+    for (size_t i = 0; i < workerCount; i++)
+        if (workers[i].output != -1)
+            runningCount++;
+
+    free(pollDescriptors);
+    free(indexes);
+
+    return runningCount;
+}
+
+
+
+size_t workersWait(worker_t * workers, size_t workerCount, int milliseconds)
+{
+    int readable;
+
+
+    return workersPoll(workers, workerCount, -1, &readable, milliseconds);
+}
+
+
+
+// The run isn't interrupted by SIGINT: workers ignore it, so does the parent relaying their output until they end.
+size_t workersRun(char * const * devicePaths, size_t deviceCount, workerFunction_t function, void * context)
+{
+    worker_t * workers;
+    struct sigaction action;
+    struct sigaction previousAction;
+    size_t failedCount = 0;
+
+
+    workers = calloc(deviceCount, sizeof(worker_t));
+    if (workers == NULL)
+        return deviceCount;
+
+    bzero(&action, sizeof(action));
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &action, &previousAction);
+
+    for (size_t i = 0; i < deviceCount; i++)
+        if (workerStart(&workers[i], devicePaths[i], function, context) != 0)
+            printf("%s: can't start worker\n", devicePaths[i]);
+
+    while (workersWait(workers, deviceCount, -1) > 0)
+        ;
+    sigaction(SIGINT, &previousAction, NULL);
+
+    printf("summary:\n");
+    for (size_t i = 0; i < deviceCount; i++)
+    {
+        printf("%s: %s\n", workers[i].path, workers[i].status == 0 ? "succeeded" : "failed");
+        if (workers[i].status != 0)
+            failedCount++;
+    }
+
+    free(workers);
+
+    return failedCount;
+}
+
+
+
+static void workersStopWatching(int signalNumber)
+{
+    stopWatching = 1;
+}
+
+
+
+static int workersFind(const glob_t * paths, const char * path)
+{
+    for (size_t i = 0; i < paths->gl_pathc; i++)
+        if (strcmp(paths->gl_pathv[i], path) == 0)
+            return 1;
+
+    return 0;
+}
+
+
+
+// no match is an empty list
+static int workersGlob(const char * pattern, glob_t * paths)
+{
+    int status;
+
+
+    bzero(paths, sizeof(*paths));
+    status = glob(pattern, 0, NULL, paths);
+
+    return status == 0 || status == GLOB_NOMATCH ? 0 : -1;
+}
+
+
+
+// Devices present when watching starts are left alone, a device removed then attached again is a new device.
+int workersWatch(const char * pattern, workerFunction_t function, void * context)
+{
+    char directory[WORKER_MAX_PATH];
+    const char * slash = strrchr(pattern, '/');
+    serialWatch_t watch;
+    struct sigaction action;
+    glob_t presentPaths;
+    glob_t paths;
+    worker_t * workers = NULL;
+    size_t workerCount = 0;
+    size_t capacity = 0;
+    int failedCount = 0;
+    int changed = 0;
+
+
+    if (slash == NULL)
+        snprintf(directory, sizeof(directory), ".");
+    else
+        snprintf(directory, sizeof(directory), "%.*s", slash == pattern ? 1 : (int) (slash - pattern), pattern);
+
+    if (serialWatchOpen(&watch, directory) != serialOK)
+    {
+        perror(directory);
+        return -1;
+    }
+
+    if (workersGlob(pattern, &presentPaths) != 0)
+    {
+        printf("can't expand '%s'\n", pattern);
+        serialWatchClose(&watch);
+        return -1;
+    }
+    for (size_t i = 0; i < presentPaths.gl_pathc; i++)
+        printf("%s: already attached, left alone\n", presentPaths.gl_pathv[i]);
+
+    bzero(&action, sizeof(action));
+    action.sa_handler = workersStopWatching;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("watching for '%s'\n", pattern);
+    fflush(stdout);
+
+    while (!stopWatching)
+    {
+        workersPoll(workers, workerCount, watch.descriptor, &changed, -1);
+
+        // report and forget finished workers
+        for (size_t i = 0; i < workerCount; )
+        {
+            if (workers[i].output != -1)
+            {
+                i++;
+                continue;
+            }
+            printf("%s: %s\n", workers[i].path, workers[i].status == 0 ? "provisioned" : "failed");
+            if (workers[i].status != 0)
+                failedCount++;
+            workers[i] = workers[--workerCount];
+        }
+        fflush(stdout);
+
+        if (!changed)
+            continue;
+        serialWatchClear(&watch);
+
+        if (workersGlob(pattern, &paths) != 0)
+            continue;
+
+        for (size_t i = 0; i < presentPaths.gl_pathc; i++)
+            if (!workersFind(&paths, presentPaths.gl_pathv[i]))
+                printf("%s: removed\n", presentPaths.gl_pathv[i]);
+
+        for (size_t i = 0; i < paths.gl_pathc; i++)
+        {
+            if (workersFind(&presentPaths, paths.gl_pathv[i]))
+                continue;
+
+            if (workerCount == capacity)
+            {
+                size_t newCapacity = capacity == 0 ? 16 : 2 * capacity;
+                worker_t * newWorkers = realloc(workers, newCapacity * sizeof(worker_t));
+
+
+                if (newWorkers == NULL)
+                {
+                    printf("%s: can't start worker\n", paths.gl_pathv[i]);
+                    continue;
+                }
+                workers = newWorkers;
+                capacity = newCapacity;
+            }
+
+            printf("%s: attached\n", paths.gl_pathv[i]);
+            if (workerStart(&workers[workerCount], paths.gl_pathv[i], function, context) != 0)
+            {
+                printf("%s: can't start worker\n", paths.gl_pathv[i]);
+                failedCount++;
+                continue;
+            }
+            workerCount++;
+        }
+        fflush(stdout);
+
+        globfree(&presentPaths);
+        presentPaths = paths;
+    }
+
+    // let running workers finish, they ignore SIGINT
+    if (workerCount > 0)
+        printf("waiting for %zu device(s) being provisioned\n", workerCount);
+    fflush(stdout);
+    while (workersWait(workers, workerCount, -1) > 0)
+        ;
+    for (size_t i = 0; i < workerCount; i++)
+    {
+        printf("%s: %s\n", workers[i].path, workers[i].status == 0 ? "provisioned" : "failed");
+        if (workers[i].status != 0)
+            failedCount++;
+    }
+    printf("watch stopped, %d failed device(s)\n", failedCount);
+
+    free(workers);
+    globfree(&presentPaths);
+    serialWatchClose(&watch);
+
+    return failedCount;
+}
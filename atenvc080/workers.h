@@ -0,0 +1,43 @@
+//
+//  workers.h
+//  atenvc080
+//
+
+// Run the same work on several devices concurrently, one child process per device.
+// Output of each worker is relayed line by line, prefixed with its device path.
+// Devices may also be watched for, with a worker started for each new device as it appears.
+
+#ifndef workers_h
+#define workers_h
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+
+#define WORKER_MAX_PATH         256
+#define WORKER_MAX_LINE         512
+
+
+
+// called in the child process, returns the exit status of the worker
+typedef int (*workerFunction_t)(const char * devicePath, void * context);
+
+typedef struct
+{
+    char path[WORKER_MAX_PATH];
+    pid_t pid;                      // -1 once the worker has been reaped
+    int output;                     // read end of the worker's stdout/stderr pipe, -1 once closed
+    char line[WORKER_MAX_LINE];
+    size_t lineLength;
+    int status;                     // exit status, valid once reaped
+} worker_t;
+
+
+
+int workerStart(worker_t * worker, const char * devicePath, workerFunction_t function, void * context);
+size_t workersWait(worker_t * workers, size_t workerCount, int milliseconds);     // returns the count of running workers
+size_t workersRun(char * const * devicePaths, size_t deviceCount, workerFunction_t function, void * context);     // returns the count of failed workers
+int workersWatch(const char * pattern, workerFunction_t function, void * context);   // until interrupted, returns the count of failed workers, -1 on error
+
+#endif /* workers_h */
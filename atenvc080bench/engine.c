@@ -0,0 +1,294 @@
+//
+//  engine.c
+//  atenvc080bench
+//
+
+// Engine driver of atenvc080bench: runs the operations of engine.h on a single device, each one from engineRun(),
+// so that the engine workflows measure the state machines the way the bench measures aten.c through atenvc080.
+// Options mirror those of atenvc080 and are run from left to right; the first failure ends the run with status 1.
+
+#define VERSION "0.3"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../atenvc080/mac.h"
+#include "../atenvc080/aten.h"
+#include "../atenvc080/edid.h"
+#include "../atenvc080/engine.h"
+#include "../atenvc080/trace.h"
+
+
+
+#define ENGINE_OPTIONS      "?CDF:T:d:qrs:w:"
+
+
+
+static engine_port_t port;
+static serialSettings_t previousSettings;
+static int displaySelected = 0;                 // -r reads the display instead of the set
+static uint8_t edid[ATEN_MAX_EDID_SIZE];
+static uint8_t written[ATEN_MAX_EDID_SIZE];     // by the last -w, to compare -r with
+static int writtenKept = 0;
+static uint8_t firmware[ATEN_FIRMWARE_SIZE_1 + ATEN_FIRMWARE_SIZE_2 + 2];
+
+
+
+void usage(void);
+int openDevice(const char * path);
+void closeDevice(void);
+int runOperation(const char * name, int status);
+int selectSet(const char * name);
+int readEDID(void);
+int writeEDID(char * path);
+int updateFirmware(const char * path);
+int runOption(int character, char * argument);
+
+
+
+void usage(void)
+{
+    //               1         2         3         4         5         6         7         8
+    //      12345678901234567890123456789012345678901234567890123456789012345678901234567890
+    printf("usage: atenvc080benchengine [-T path] -d serial [options]\n");
+    printf("\n");
+    printf("       -T path       record a trace of the serial I/O, as atenvc080 -T\n");
+    printf("       options: (options are executed from left to right)\n");
+    printf("       -d device     mandatory option that must come first\n");
+    printf("       -q            identify the device\n");
+    printf("       -s set        select DEFAULT, 1, 2 or 3; DISPLAY makes -r read the display\n");
+    printf("       -r            read the set, or the display, and validate the EDID. After\n");
+    printf("                       -w, the EDID read must be the one written\n");
+    printf("       -w path       write the EDID of file at path to the set\n");
+    printf("       -C            connect CEC\n");
+    printf("       -D            disconnect CEC\n");
+    printf("       -F path       update the firmware with file at path\n");
+    printf("       -?            print this help\n");
+}
+
+
+
+int openDevice(const char * path)
+{
+    serial_t serialDevice;
+
+
+    if (serialOpenPort(&serialDevice, path, &previousSettings) != serialOK)
+    {
+        printf("can't open '%s'\n", path);
+        return 1;
+    }
+
+    if (serialSetRate(serialDevice, 115200, 115200) != serialOK || serialSetRTS(serialDevice, 0) != serialOK)
+    {
+        printf("can't set up '%s'\n", path);
+        serialClosePort(serialDevice, &previousSettings);       // dismiss errors
+        return 1;
+    }
+    pauseMilliseconds(100);
+    serialClearPendingBytes(serialDevice);                      // purge serial input buffer, dismiss errors
+
+    enginePortInit(&port, serialDevice, NULL, NULL);
+
+    return 0;
+}
+
+
+
+void closeDevice(void)
+{
+    if (port.serialDevice != serialClosed)
+        serialClosePort(port.serialDevice, &previousSettings);  // dismiss errors
+}
+
+
+
+// status is that of the function starting the operation
+int runOperation(const char * name, int status)
+{
+    engine_port_t * ports[1] = { &port };
+    uintmax_t start = monotonicMilliseconds();
+
+
+    if (status == ATEN_NO_ERROR)
+    {
+        engineRun(ports, 1);
+        status = port.status;
+    }
+
+    if (status != ATEN_NO_ERROR)
+    {
+        printf("%s: failed with status %d\n", name, status);
+        return 1;
+    }
+    printf("%s: done in %ju ms\n", name, monotonicMilliseconds() - start);
+
+    return 0;
+}
+
+
+
+int selectSet(const char * name)
+{
+    static const char * names[] = { "DEFAULT", "1", "2", "3" };
+
+
+    displaySelected = strcmp(name, "DISPLAY") == 0;
+    if (displaySelected)
+        return 0;
+
+    for (int setID = ATEN_SET_DEFAULT; setID <= ATEN_SET_3; setID++)
+        if (strcmp(name, names[setID]) == 0)
+            return runOperation("select set", engineSelectSet(&port, setID));
+
+    printf("invalid set '%s'\n", name);
+
+    return 1;
+}
+
+
+
+int readEDID(void)
+{
+    bzero(edid, sizeof(edid));
+    if (displaySelected)
+    {
+        if (runOperation("read display", engineReadDisplay(&port, edid)) != 0)
+            return 1;
+    }
+    else if (runOperation("read set", engineReadSet(&port, edid)) != 0)
+        return 1;
+
+    if (edidIsValid(edid) != ATEN_NO_ERROR)
+    {
+        printf("EDID read is invalid\n");
+        return 1;
+    }
+    if (writtenKept && !displaySelected && edidCompare(edid, written) != 0)
+    {
+        printf("EDID read isn't the one written\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+int writeEDID(char * path)
+{
+    if (atenReadEDIDFromFile(written, path) != ATEN_NO_ERROR)
+    {
+        printf("can't read an EDID from '%s'\n", path);
+        return 1;
+    }
+    writtenKept = 1;
+
+    return runOperation("write", engineWriteEDID(&port, written));
+}
+
+
+
+int updateFirmware(const char * path)
+{
+    int fileDescriptor;
+    ssize_t byteCount;
+
+
+    fileDescriptor = open(path, O_RDONLY);
+    if (fileDescriptor < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    byteCount = read(fileDescriptor, firmware, sizeof(firmware));
+    close(fileDescriptor);
+    if (byteCount != sizeof(firmware))
+    {
+        printf("'%s' isn't a firmware file\n", path);
+        return 1;
+    }
+
+    return runOperation("firmware update", engineUpdateFirmware(&port, firmware, sizeof(firmware), NULL, NULL, NULL));
+}
+
+
+
+int runOption(int character, char * argument)
+{
+    if (character == '?')
+    {
+        usage();
+        return 1;
+    }
+    if (character != 'T' && character != 'd' && port.serialDevice == serialClosed)
+    {
+        printf("-d must come first\n");
+        return 1;
+    }
+
+    switch (character)
+    {
+    case 'T':
+        if (traceOpen(argument) != 0)
+        {
+            perror(argument);
+            return 1;
+        }
+        atexit(traceClose);
+        return 0;
+    case 'd':
+        if (port.serialDevice != serialClosed)
+        {
+            printf("-d may be given once\n");
+            return 1;
+        }
+        return openDevice(argument);
+    case 'q':
+        if (runOperation("identify", engineIdentify(&port)) != 0)
+            return 1;
+        printf("device type 0x%02x\n", port.deviceType);
+        return 0;
+    case 's': return selectSet(argument);
+    case 'r': return readEDID();
+    case 'w': return writeEDID(argument);
+    case 'C': return runOperation("CEC connect", engineCECConnect(&port));
+    case 'D': return runOperation("CEC disconnect", engineCECDisconnect(&port));
+    case 'F': return updateFirmware(argument);
+    default:  return 1;
+    }
+}
+
+
+
+int main(int argc, char * const argv[])
+{
+    int character;
+    int result = 0;
+
+
+    port.serialDevice = serialClosed;
+
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+
+    while (result == 0 && (character = getopt(argc, argv, ENGINE_OPTIONS)) != -1)
+        result = runOption(character, optarg);
+    if (result == 0 && optind != argc)
+    {
+        usage();
+        result = 1;
+    }
+
+    closeDevice();
+
+    return result;
+}
@@ -0,0 +1,612 @@
+//
+//  main.c
+//  atenvc080bench
+//
+
+// End-to-end benchmark of atenvc080 workflows against atenvc080sim.
+// Each workflow runs the atenvc080 binary, so the measured code paths are those of the tool itself. The engine
+// workflows run atenvc080benchengine instead, which drives the same operations through the state machines of engine.h.
+// Wall time is the median of the runs, CPU times are averages, serial calls are counted
+// in a trace recorded with -T by an extra run.
+
+#define VERSION "0.3"
+
+#if !defined(__APPLE__)
+#define _GNU_SOURCE                             // nftw() and wait4() with glibc
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+
+
+#define BENCH_BLOCK_SIZE            128
+#define BENCH_FIRMWARE_SIZE         (0x40 + 0x2a40)
+#define BENCH_MAX_RUNS              100
+#define BENCH_MAX_WORKFLOWS         16
+#define BENCH_MAX_ARGUMENTS         16
+#define BENCH_WALL_SLACK            5.0         // milliseconds, wall time differences below are noise
+
+
+
+typedef struct
+{
+    const char * name;
+    int engine;                                         // run by atenvc080benchengine rather than atenvc080
+    const char * arguments[BENCH_MAX_ARGUMENTS];        // after -d device, NULL terminated, "@" is replaced by the work directory
+} workflow_t;
+
+typedef struct
+{
+    double wall;                    // milliseconds
+    double user;
+    double system;
+    long voluntarySwitches;         // blocking waits
+    long serialCalls;               // serial reads, writes, waits and pauses
+    int failed;
+} measure_t;
+
+typedef struct
+{
+    char name[64];
+    measure_t measure;
+} baseline_t;
+
+
+
+static const workflow_t workflows[] =
+{
+    { "query",            0, { "-q", NULL } },
+    { "switch",           0, { "-s", "1", NULL } },
+    { "read-base",        0, { "-s", "1", "-r", "@/read.bin", NULL } },
+    { "read-extension",   0, { "-s", "DISPLAY", "-r", "@/read.bin", NULL } },
+    { "write",            0, { "-s", "2", "-w", "@/extension.bin", NULL } },
+    { "write-identical",  0, { "-s", "2", "-i", "-w", "@/extension.bin", NULL } },
+    { "cec",              0, { "-C", "-D", NULL } },
+    { "firmware",         0, { "-F", "@/firmware.bin", NULL } },
+    { "engine-query",     1, { "-q", NULL } },
+    { "engine-switch",    1, { "-s", "1", NULL } },
+    { "engine-read-base", 1, { "-s", "1", "-r", NULL } },
+    { "engine-read-ext",  1, { "-s", "DISPLAY", "-r", NULL } },
+    { "engine-write",     1, { "-s", "2", "-w", "@/extension.bin", "-r", NULL } },
+    { "engine-cec",       1, { "-C", "-D", NULL } },
+    { "engine-firmware",  1, { "-F", "@/firmware.bin", NULL } },
+};
+
+static char workDirectory[] = "/tmp/atenvc080bench.XXXXXX";
+static pid_t simulator = -1;
+
+
+
+void usage(void);
+double milliseconds(struct timeval time);
+double monotonicMilliseconds(void);
+void edidSetChecksums(uint8_t * edid, int blockCount);
+int writeFile(const char * path, const uint8_t * bytes, size_t byteCount);
+int makeInputFiles(void);
+int startSimulator(const char * simulatorPath, unsigned long latency, char * devicePath, size_t devicePathSize);
+void stopSimulator(void);
+int runWorkflow(const char * toolPath, const char * devicePath, const workflow_t * workflow, const char * tracePath, measure_t * measure);
+long countSerialCalls(const char * tracePath);
+int compareDoubles(const void * a, const void * b);
+int measureWorkflow(const char * toolPath, const char * devicePath, const workflow_t * workflow, int runCount, measure_t * measure);
+size_t loadBaseline(const char * path, baseline_t * baselines, size_t maxCount);
+int storeBaseline(const char * path, const measure_t * measures);
+int removeEntry(const char * path, const struct stat * status, int type, struct FTW * ftw);
+
+
+
+void usage(void)
+{
+    //               1         2         3         4         5         6         7         8
+    //      12345678901234567890123456789012345678901234567890123456789012345678901234567890
+    printf("usage: atenvc080bench [options]\n");
+    printf("\n");
+    printf("       options:\n");
+    printf("       -a path       atenvc080 binary (default build/atenvc080)\n");
+    printf("       -e path       atenvc080benchengine binary, for the engine workflows\n");
+    printf("                       (default build/atenvc080benchengine)\n");
+    printf("       -s path       atenvc080sim binary (default build/atenvc080sim)\n");
+    printf("       -l latency    simulated device latency in milliseconds (default 2)\n");
+    printf("       -n count      runs of each workflow (default 3)\n");
+    printf("       -b path       baseline to compare with\n");
+    printf("       -u            store the results as baseline, instead of comparing\n");
+    printf("       -t percent    tolerated slowdown before a regression is flagged\n");
+    printf("                       (default 20)\n");
+    printf("       -?            print this help\n");
+    printf("\n");
+    printf("       Exits with status 1 if a workflow failed or regressed.\n");
+}
+
+
+
+double milliseconds(struct timeval time)
+{
+    return time.tv_sec * 1000.0 + time.tv_usec / 1000.0;
+}
+
+
+
+double monotonicMilliseconds(void)
+{
+    struct timespec now;
+
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+
+
+void edidSetChecksums(uint8_t * edid, int blockCount)
+{
+    for (int block = 0; block < blockCount; block++)
+    {
+        uint8_t sum = 0;
+
+
+        for (size_t i = 0; i < BENCH_BLOCK_SIZE - 1; i++)
+            sum += edid[block * BENCH_BLOCK_SIZE + i];
+        edid[block * BENCH_BLOCK_SIZE + BENCH_BLOCK_SIZE - 1] = 0x100 - sum;
+    }
+}
+
+
+
+int writeFile(const char * path, const uint8_t * bytes, size_t byteCount)
+{
+    int fileDescriptor;
+    ssize_t written;
+
+
+    fileDescriptor = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fileDescriptor < 0)
+        return -1;
+
+    written = write(fileDescriptor, bytes, byteCount);
+    close(fileDescriptor);
+
+    return written == (ssize_t) byteCount ? 0 : -1;
+}
+
+
+
+// base-only EDID for the simulated sets, EDID with a CTA-861 extension to write, firmware file
+int makeInputFiles(void)
+{
+    static const uint8_t header[] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+    uint8_t edid[2 * BENCH_BLOCK_SIZE];
+    uint8_t firmware[BENCH_FIRMWARE_SIZE + 2];
+    uint16_t sum = 0;
+    char path[PATH_MAX];
+
+
+    bzero(edid, sizeof(edid));
+    memcpy(edid, header, sizeof(header));
+    edid[0x08] = 0x06;          // manufacturer "ATN"
+    edid[0x09] = 0x8e;
+    edid[0x12] = 1;             // EDID version 1.3
+    edid[0x13] = 3;
+    edidSetChecksums(edid, 1);
+    snprintf(path, sizeof(path), "%s/base.bin", workDirectory);
+    if (writeFile(path, edid, BENCH_BLOCK_SIZE) != 0)
+        return -1;
+
+    edid[0x7e] = 1;
+    edid[BENCH_BLOCK_SIZE + 0] = 0x02;      // CTA-861 extension, no data block
+    edid[BENCH_BLOCK_SIZE + 1] = 0x03;
+    edid[BENCH_BLOCK_SIZE + 2] = 0x04;
+    edidSetChecksums(edid, 2);
+    snprintf(path, sizeof(path), "%s/extension.bin", workDirectory);
+    if (writeFile(path, edid, 2 * BENCH_BLOCK_SIZE) != 0)
+        return -1;
+
+    for (size_t i = 0; i < BENCH_FIRMWARE_SIZE; i++)
+        firmware[i] = (uint8_t) (i * 7);
+    memcpy(firmware, "ATENVC060/080", 13);
+    for (size_t i = 0; i < BENCH_FIRMWARE_SIZE; i += 2)
+        sum += (firmware[i] << 8) | firmware[i + 1];
+    firmware[BENCH_FIRMWARE_SIZE] = sum >> 8;
+    firmware[BENCH_FIRMWARE_SIZE + 1] = sum;
+    snprintf(path, sizeof(path), "%s/firmware.bin", workDirectory);
+    if (writeFile(path, firmware, sizeof(firmware)) != 0)
+        return -1;
+
+    return 0;
+}
+
+
+
+int startSimulator(const char * simulatorPath, unsigned long latency, char * devicePath, size_t devicePathSize)
+{
+    int descriptors[2];
+    char latencyArgument[32];
+    char edidPath[PATH_MAX];
+    FILE * output;
+
+
+    snprintf(latencyArgument, sizeof(latencyArgument), "%lu", latency);
+    snprintf(edidPath, sizeof(edidPath), "%s/base.bin", workDirectory);
+
+    if (pipe(descriptors) == -1)
+        return -1;
+
+    simulator = fork();
+    if (simulator == -1)
+        return -1;
+
+    if (simulator == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+
+
+        close(descriptors[0]);
+        dup2(descriptors[1], STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);          // its statistics would clutter the results
+        close(descriptors[1]);
+        execl(simulatorPath, simulatorPath, "-l", latencyArgument, "-e", edidPath, (char *) NULL);
+        perror(simulatorPath);
+        _exit(1);
+    }
+
+    close(descriptors[1]);
+    output = fdopen(descriptors[0], "r");
+    if (output == NULL || fgets(devicePath, (int) devicePathSize, output) == NULL)
+    {
+        if (output != NULL)
+            fclose(output);
+        return -1;
+    }
+    fclose(output);     // the simulator prints nothing else on stdout
+    devicePath[strcspn(devicePath, "\n")] = '\0';
+
+    return 0;
+}
+
+
+
+void stopSimulator(void)
+{
+    if (simulator <= 0)
+        return;
+
+    kill(simulator, SIGINT);
+    waitpid(simulator, NULL, 0);
+    simulator = -1;
+}
+
+
+
+// tracePath may be NULL
+int runWorkflow(const char * toolPath, const char * devicePath, const workflow_t * workflow, const char * tracePath, measure_t * measure)
+{
+    char arguments[BENCH_MAX_ARGUMENTS + 5][PATH_MAX];
+    char * argv[BENCH_MAX_ARGUMENTS + 6];
+    int argc = 0;
+    struct rusage usage;
+    double start;
+    pid_t pid;
+    int status;
+
+
+    snprintf(arguments[argc++], PATH_MAX, "%s", toolPath);
+    if (tracePath != NULL)
+    {
+        snprintf(arguments[argc++], PATH_MAX, "-T");
+        snprintf(arguments[argc++], PATH_MAX, "%s", tracePath);
+    }
+    snprintf(arguments[argc++], PATH_MAX, "-d");
+    snprintf(arguments[argc++], PATH_MAX, "%s", devicePath);
+    for (int i = 0; workflow->arguments[i] != NULL; i++)
+    {
+        if (workflow->arguments[i][0] == '@')
+            snprintf(arguments[argc++], PATH_MAX, "%s%s", workDirectory, workflow->arguments[i] + 1);
+        else
+            snprintf(arguments[argc++], PATH_MAX, "%s", workflow->arguments[i]);
+    }
+    for (int i = 0; i < argc; i++)
+        argv[i] = arguments[i];
+    argv[argc] = NULL;
+
+    start = monotonicMilliseconds();
+    pid = fork();
+    if (pid == -1)
+        return -1;
+
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+
+
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(toolPath, argv);
+        _exit(127);
+    }
+
+    if (wait4(pid, &status, 0, &usage) == -1)
+        return -1;
+
+    measure->wall = monotonicMilliseconds() - start;
+    measure->user = milliseconds(usage.ru_utime);
+    measure->system = milliseconds(usage.ru_stime);
+    measure->voluntarySwitches = usage.ru_nvcsw;
+    measure->failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+
+    return 0;
+}
+
+
+
+long countSerialCalls(const char * tracePath)
+{
+    char line[1024];
+    long count = 0;
+    FILE * trace;
+
+
+    trace = fopen(tracePath, "r");
+    if (trace == NULL)
+        return -1;
+
+    // one event per line
+    while (fgets(line, sizeof(line), trace) != NULL)
+        if (strstr(line, "\"cat\":\"serial\"") != NULL || strstr(line, "\"cat\":\"timing\"") != NULL)
+            count++;
+
+    fclose(trace);
+
+    return count;
+}
+
+
+
+int compareDoubles(const void * a, const void * b)
+{
+    double difference = *(const double *) a - *(const double *) b;
+
+    return difference < 0 ? -1 : difference > 0 ? 1 : 0;
+}
+
+
+
+int measureWorkflow(const char * toolPath, const char * devicePath, const workflow_t * workflow, int runCount, measure_t * measure)
+{
+    double walls[BENCH_MAX_RUNS];
+    measure_t run;
+    char tracePath[PATH_MAX];
+
+
+    bzero(measure, sizeof(measure_t));
+
+    for (int i = 0; i < runCount; i++)
+    {
+        if (runWorkflow(toolPath, devicePath, workflow, NULL, &run) != 0)
+            return -1;
+
+        walls[i] = run.wall;
+        measure->user += run.user / runCount;
+        measure->system += run.system / runCount;
+        measure->voluntarySwitches += run.voluntarySwitches;
+        measure->failed |= run.failed;
+    }
+    qsort(walls, runCount, sizeof(double), compareDoubles);
+    measure->wall = walls[runCount / 2];
+    measure->voluntarySwitches /= runCount;
+
+    // tracing has a cost of its own, so count calls in a separate run
+    snprintf(tracePath, sizeof(tracePath), "%s/trace.json", workDirectory);
+    if (runWorkflow(toolPath, devicePath, workflow, tracePath, &run) != 0)
+        return -1;
+    measure->serialCalls = countSerialCalls(tracePath);
+    measure->failed |= run.failed;
+
+    return 0;
+}
+
+
+
+// Lines are: workflow wall user system switches calls
+size_t loadBaseline(const char * path, baseline_t * baselines, size_t maxCount)
+{
+    char line[256];
+    size_t count = 0;
+    FILE * file;
+
+
+    file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+
+    while (count < maxCount && fgets(line, sizeof(line), file) != NULL)
+    {
+        baseline_t * baseline = &baselines[count];
+
+
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%63s %lf %lf %lf %ld %ld", baseline->name, &baseline->measure.wall, &baseline->measure.user,
+                   &baseline->measure.system, &baseline->measure.voluntarySwitches, &baseline->measure.serialCalls) == 6)
+            count++;
+    }
+
+    fclose(file);
+
+    return count;
+}
+
+
+
+int storeBaseline(const char * path, const measure_t * measures)
+{
+    FILE * file;
+
+
+    file = fopen(path, "w");
+    if (file == NULL)
+        return -1;
+
+    fprintf(file, "# atenvc080bench baseline: workflow, wall ms, user ms, system ms, voluntary context switches, serial calls\n");
+    for (size_t i = 0; i < sizeof(workflows) / sizeof(workflows[0]); i++)
+        fprintf(file, "%s %.1f %.1f %.1f %ld %ld\n", workflows[i].name, measures[i].wall, measures[i].user,
+                measures[i].system, measures[i].voluntarySwitches, measures[i].serialCalls);
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+
+
+int removeEntry(const char * path, const struct stat * status, int type, struct FTW * ftw)
+{
+    return remove(path);
+}
+
+
+
+int main(int argc, char * const argv[])
+{
+    const char * toolPath = "build/atenvc080";
+    const char * enginePath = "build/atenvc080benchengine";
+    const char * simulatorPath = "build/atenvc080sim";
+    const char * baselinePath = NULL;
+    unsigned long latency = 2;
+    int runCount = 3;
+    int updateBaseline = 0;
+    double tolerance = 20.0;
+    char devicePath[PATH_MAX];
+    char cachePath[PATH_MAX];
+    measure_t measures[BENCH_MAX_WORKFLOWS];
+    baseline_t baselines[BENCH_MAX_WORKFLOWS];
+    size_t baselineCount = 0;
+    int failedCount = 0;
+    int regressionCount = 0;
+    int character;
+
+
+    while ((character = getopt(argc, argv, "?a:b:e:l:n:s:t:u")) != -1)
+    {
+        switch (character)
+        {
+        case 'a': toolPath = optarg; break;
+        case 'b': baselinePath = optarg; break;
+        case 'e': enginePath = optarg; break;
+        case 'l': latency = strtoul(optarg, NULL, 10); break;
+        case 'n': runCount = atoi(optarg); break;
+        case 's': simulatorPath = optarg; break;
+        case 't': tolerance = atof(optarg); break;
+        case 'u': updateBaseline = 1; break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (optind != argc || runCount < 1 || runCount > BENCH_MAX_RUNS || (updateBaseline && baselinePath == NULL))
+    {
+        usage();
+        return 1;
+    }
+
+    printf("atenvc080bench v%s\n", VERSION);
+
+    if (mkdtemp(workDirectory) == NULL)
+    {
+        perror(workDirectory);
+        return 1;
+    }
+
+    // keep the user's EDID cache out of the measures
+    snprintf(cachePath, sizeof(cachePath), "%s/cache", workDirectory);
+    setenv("XDG_CACHE_HOME", cachePath, 1);
+
+    if (makeInputFiles() != 0 || startSimulator(simulatorPath, latency, devicePath, sizeof(devicePath)) != 0)
+    {
+        printf("can't set up the benchmark\n");
+        stopSimulator();
+        nftw(workDirectory, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+        return 1;
+    }
+
+    if (baselinePath != NULL && !updateBaseline)
+        baselineCount = loadBaseline(baselinePath, baselines, BENCH_MAX_WORKFLOWS);
+
+    printf("device latency %lu ms, %d run(s) per workflow\n\n", latency, runCount);
+    printf("%-16s %10s %9s %9s %9s %7s\n", "workflow", "wall ms", "user ms", "sys ms", "switches", "calls");
+    for (size_t i = 0; i < sizeof(workflows) / sizeof(workflows[0]); i++)
+    {
+        measure_t * measure = &measures[i];
+        const baseline_t * baseline = NULL;
+        const char * path = workflows[i].engine ? enginePath : toolPath;
+
+
+        if (measureWorkflow(path, devicePath, &workflows[i], runCount, measure) != 0)
+        {
+            printf("%-16s can't run %s\n", workflows[i].name, path);
+            failedCount++;
+            continue;
+        }
+
+        printf("%-16s %10.1f %9.1f %9.1f %9ld %7ld", workflows[i].name, measure->wall, measure->user, measure->system,
+               measure->voluntarySwitches, measure->serialCalls);
+
+        for (size_t j = 0; j < baselineCount; j++)
+            if (strcmp(baselines[j].name, workflows[i].name) == 0)
+                baseline = &baselines[j];
+
+        if (measure->failed)
+        {
+            printf("  FAILED");
+            failedCount++;
+        }
+        else if (baseline != NULL)
+        {
+            if (measure->wall > baseline->measure.wall * (1 + tolerance / 100) + BENCH_WALL_SLACK)
+            {
+                printf("  REGRESSION wall %.1f ms, was %.1f ms", measure->wall, baseline->measure.wall);
+                regressionCount++;
+            }
+            if (measure->serialCalls > baseline->measure.serialCalls * (1 + tolerance / 100))
+            {
+                printf("  REGRESSION calls %ld, was %ld", measure->serialCalls, baseline->measure.serialCalls);
+                regressionCount++;
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    stopSimulator();
+    nftw(workDirectory, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+
+    if (updateBaseline && failedCount == 0)
+    {
+        if (storeBaseline(baselinePath, measures) != 0)
+        {
+            perror(baselinePath);
+            return 1;
+        }
+        printf("\nbaseline stored to '%s'\n", baselinePath);
+    }
+    else if (baselinePath != NULL && baselineCount == 0 && !updateBaseline)
+        printf("\nno baseline in '%s'\n", baselinePath);
+
+    if (failedCount > 0 || regressionCount > 0)
+    {
+        printf("\n%d failed workflow(s), %d regression(s)\n", failedCount, regressionCount);
+        return 1;
+    }
+
+    return 0;
+}
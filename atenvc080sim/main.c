@@ -0,0 +1,701 @@
+//
+//  main.c
+//  atenvc080sim
+//
+
+// ATEN VC080 simulator: serves the VC080 RS232 protocol on pseudo-terminals,
+// so that atenvc080 can be run with -d /dev/pts/N (or /dev/ttysNNN) without hardware.
+
+#define VERSION "0.3"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+
+
+#define SIM_BLOCK_SIZE              128
+#define SIM_MAX_EDID_SIZE           (2 * SIM_BLOCK_SIZE)        // the device holds a base block and one extension
+#define SIM_EXTENSION_COUNT_OFFSET  0x7e
+#define SIM_SET_COUNT               4                           // DEFAULT, SET 1-3
+#define SIM_OUTPUT_SIZE             1024
+#define SIM_MAX_PENDING_REPLIES     16
+#define SIM_MAX_FRAME_SIZE          80
+
+
+
+typedef enum
+{
+    simIdle = 0,
+    simWritingEDID,                 // receiving blocks after 0x0a
+    simFirmwareFrame,               // receiving a 'F' 'U' frame
+} simState_t;
+
+typedef struct
+{
+    size_t end;                     // offset in output just past this reply
+    uintmax_t due;                  // when this reply may be sent
+} simReply_t;
+
+typedef struct
+{
+    int master;
+    int slave;
+    char path[64];
+
+    simState_t state;
+    int currentSet;
+    int cec;
+    uint8_t sets[SIM_SET_COUNT][SIM_MAX_EDID_SIZE];
+    uint8_t display[SIM_MAX_EDID_SIZE];
+
+    const uint8_t * readEDID;       // EDID whose extensions are returned by 0x05
+    int nextBlock;
+
+    uint8_t writeBuffer[SIM_MAX_EDID_SIZE];
+    size_t writeReceived;
+    size_t writeExpected;
+
+    uint8_t frame[SIM_MAX_FRAME_SIZE];
+    size_t frameReceived;
+    size_t frameExpected;
+    int firmwareChunk;              // next 0xa3 chunk accepted, -1 until 0xa0 erased the flash
+
+    uint8_t output[SIM_OUTPUT_SIZE];
+    size_t outputLength;
+    simReply_t replies[SIM_MAX_PENDING_REPLIES];
+    int replyCount;
+
+    unsigned long commandCount;
+} simDevice_t;
+
+
+
+static unsigned long latency = 0;          // milliseconds
+static uint8_t deviceType = 0x80;
+static long corruptedWriteCount = 0;        // first EDID writes stored with a flipped bit
+static long lostCommandCount = 0;           // first commands dismissed unanswered
+static int forgetFirmwareUpload = 0;        // firmware mode entry restarts the upload
+static int verbose = 0;
+static volatile sig_atomic_t quit = 0;
+static volatile sig_atomic_t reloadDisplay = 0;
+
+
+
+void usage(void);
+uintmax_t monotonicMilliseconds(void);
+void edidSetChecksums(uint8_t edid[SIM_MAX_EDID_SIZE]);
+void makeDefaultEDID(uint8_t edid[SIM_MAX_EDID_SIZE], const char * name, int withExtension);
+int loadEDID(uint8_t edid[SIM_MAX_EDID_SIZE], const char * path);
+int openDevice(simDevice_t * device);
+void queueReply(simDevice_t * device, const uint8_t * bytes, size_t byteCount);
+void flushReplies(simDevice_t * device, uintmax_t now);
+void receiveByte(simDevice_t * device, uint8_t byte);
+void receiveFirmwareFrame(simDevice_t * device);
+
+
+
+void usage(void)
+{
+    //               1         2         3         4         5         6         7         8
+    //      12345678901234567890123456789012345678901234567890123456789012345678901234567890
+    printf("usage: atenvc080sim [options]\n");
+    printf("\n");
+    printf("       options:\n");
+    printf("       -n count      number of simulated devices (default 1)\n");
+    printf("       -l latency    reply latency in milliseconds (default 0)\n");
+    printf("       -t type       device type returned to identification request\n");
+    printf("                       (default 0x80, VC080)\n");
+    printf("       -e path       initial EDID of all sets\n");
+    printf("       -E path       EDID of the connected display, read again on SIGUSR1\n");
+    printf("       -c count      corrupt one bit of the first 'count' EDID writes\n");
+    printf("       -x count      lose the first 'count' commands, firmware frames\n");
+    printf("                       excepted, as a noisy line would\n");
+    printf("       -r            forget an interrupted firmware upload when firmware mode\n");
+    printf("                       is entered again, so that it can't be resumed\n");
+    printf("       -v            log received commands\n");
+    printf("       -?            print this help\n");
+    printf("\n");
+    printf("       The path of each simulated device is printed on standard output,\n");
+    printf("       one per line. Stop the simulator with ^C.\n");
+}
+
+
+
+uintmax_t monotonicMilliseconds(void)
+{
+    struct timespec now;
+
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uintmax_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+
+void edidSetChecksums(uint8_t edid[SIM_MAX_EDID_SIZE])
+{
+    int blockCount = 1 + edid[SIM_EXTENSION_COUNT_OFFSET];
+
+
+    for (int block = 0; block < blockCount; block++)
+    {
+        uint8_t sum = 0;
+
+
+        for (size_t i = 0; i < SIM_BLOCK_SIZE - 1; i++)
+            sum += edid[block * SIM_BLOCK_SIZE + i];
+        edid[block * SIM_BLOCK_SIZE + SIM_BLOCK_SIZE - 1] = 0x100 - sum;
+    }
+}
+
+
+
+// A minimal EDID 1.3 with a monitor name descriptor, and optionally an empty CTA-861 extension.
+void makeDefaultEDID(uint8_t edid[SIM_MAX_EDID_SIZE], const char * name, int withExtension)
+{
+    static const uint8_t header[] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+    uint8_t * descriptor;
+
+
+    bzero(edid, SIM_MAX_EDID_SIZE);
+    memcpy(edid, header, sizeof(header));
+    edid[0x08] = 0x06;          // manufacturer "ATN"
+    edid[0x09] = 0x8e;
+    edid[0x0a] = 0x80;          // product code 0x0080
+    edid[0x10] = 1;             // week
+    edid[0x11] = 32;            // year 2022
+    edid[0x12] = 1;             // EDID version 1.3
+    edid[0x13] = 3;
+    edid[0x14] = 0x80;          // digital input
+
+    descriptor = edid + 0x36 + 3 * 18;
+    descriptor[3] = 0xfc;       // monitor name
+    memset(descriptor + 5, ' ', 13);
+    memcpy(descriptor + 5, name, strlen(name) < 13 ? strlen(name) : 13);
+
+    if (withExtension)
+    {
+        edid[SIM_EXTENSION_COUNT_OFFSET] = 1;
+        edid[SIM_BLOCK_SIZE + 0] = 0x02;    // CTA-861 extension
+        edid[SIM_BLOCK_SIZE + 1] = 0x03;
+        edid[SIM_BLOCK_SIZE + 2] = 0x04;    // no data block
+    }
+
+    edidSetChecksums(edid);
+}
+
+
+
+int loadEDID(uint8_t edid[SIM_MAX_EDID_SIZE], const char * path)
+{
+    int fileDescriptor;
+    ssize_t byteCount;
+
+
+    bzero(edid, SIM_MAX_EDID_SIZE);
+
+    fileDescriptor = open(path, O_RDONLY);
+    if (fileDescriptor < 0)
+        return -1;
+
+    byteCount = read(fileDescriptor, edid, SIM_MAX_EDID_SIZE);
+    close(fileDescriptor);
+
+    if (byteCount < SIM_BLOCK_SIZE || byteCount < (1 + edid[SIM_EXTENSION_COUNT_OFFSET]) * SIM_BLOCK_SIZE)
+        return -1;
+
+    return 0;
+}
+
+
+
+int openDevice(simDevice_t * device)
+{
+    struct termios options;
+
+
+    if (openpty(&device->master, &device->slave, device->path, NULL, NULL) == -1)
+        return -1;
+
+    // The slave side is kept open, so that the master does not see a hangup
+    // each time atenvc080 closes the device.
+    if (tcgetattr(device->slave, &options) == 0)
+    {
+        cfmakeraw(&options);
+        tcsetattr(device->slave, TCSANOW, &options);
+    }
+
+    fcntl(device->master, F_SETFL, fcntl(device->master, F_GETFL) | O_NONBLOCK);
+
+    return 0;
+}
+
+
+
+void queueReply(simDevice_t * device, const uint8_t * bytes, size_t byteCount)
+{
+    if (device->outputLength + byteCount > SIM_OUTPUT_SIZE || device->replyCount == SIM_MAX_PENDING_REPLIES)
+    {
+        fprintf(stderr, "%s: output overflow, reply dropped\n", device->path);
+        return;
+    }
+
+    memcpy(device->output + device->outputLength, bytes, byteCount);
+    device->outputLength += byteCount;
+    device->replies[device->replyCount].end = device->outputLength;
+    device->replies[device->replyCount].due = monotonicMilliseconds() + latency;
+    device->replyCount++;
+}
+
+
+
+void flushReplies(simDevice_t * device, uintmax_t now)
+{
+    size_t releasable = 0;
+    ssize_t written;
+    int released = 0;
+
+
+    while (released < device->replyCount && device->replies[released].due <= now)
+        releasable = device->replies[released++].end;
+
+    if (releasable == 0)
+        return;
+
+    written = write(device->master, device->output, releasable);
+    if (written <= 0)
+        return;
+
+    memmove(device->output, device->output + written, device->outputLength - written);
+    device->outputLength -= written;
+
+    released = 0;
+    for (int i = 0; i < device->replyCount; i++)
+    {
+        if (device->replies[i].end <= (size_t) written)
+            continue;
+        device->replies[released].end = device->replies[i].end - written;
+        device->replies[released].due = device->replies[i].due;
+        released++;
+    }
+    device->replyCount = released;
+}
+
+
+
+// Frame lengths include the trailing checksum byte.
+static size_t firmwareCommandLength(uint8_t command)
+{
+    switch (command)
+    {
+    case 0xff: return 6;
+    case 0x80: return 28;
+    case 0x90: return 7;
+    case 0xa0: return 7;
+    case 0xa2: return 69;
+    case 0xa3: return 71;
+    case 0xa4: return 7;
+    case 0xa5: return 7;
+    default:   return 0;
+    }
+}
+
+
+
+void receiveFirmwareFrame(simDevice_t * device)
+{
+    uint8_t * frame = device->frame;
+    uint8_t reply[50];
+    size_t replyLength;
+    uint8_t sum = 0;
+
+
+    for (size_t i = 0; i < device->frameExpected - 1; i++)
+        sum += frame[i];
+    if (sum != frame[device->frameExpected - 1])
+    {
+        fprintf(stderr, "%s: firmware frame 0x%02x with bad checksum dismissed\n", device->path, frame[2]);
+        return;
+    }
+
+    bzero(reply, sizeof(reply));
+    reply[0] = 'F';
+    reply[1] = 'U';
+    reply[2] = frame[2] ^ 0x80;
+    reply[3] = frame[3];
+
+    switch (frame[2])
+    {
+    case 0xff:
+        replyLength = 32;
+        if (forgetFirmwareUpload)
+            device->firmwareChunk = -1;
+        break;
+    case 0x80:
+        replyLength = 5;
+        break;
+    case 0x90:
+        replyLength = 50;
+        memcpy(reply + 4, "VC060/080", 9);
+        memcpy(reply + 28, "10.000", 6);        // firmware v1.0.000
+        memcpy(reply + 35, "10.000", 6);        // microcode v1.0.000
+        memcpy(reply + 42, "SIMCPU ", 7);
+        break;
+    case 0xa0:
+        replyLength = 6;
+        device->firmwareChunk = 0;
+        break;
+    case 0xa3:
+        replyLength = 8;
+        reply[4] = frame[4];
+        reply[5] = frame[5];
+        // chunks are flashed in order after the erase, the last one may be sent again
+        if (device->firmwareChunk < 0 || ((frame[4] << 8) | frame[5]) > device->firmwareChunk || ((frame[4] << 8) | frame[5]) + 1 < device->firmwareChunk)
+            reply[6] = 0x01;
+        else if (((frame[4] << 8) | frame[5]) == device->firmwareChunk)
+            device->firmwareChunk++;
+        break;
+    case 0xa5:
+        replyLength = 6;
+        reply[3] = 0x00;
+        break;
+    default:
+        replyLength = 6;
+        break;
+    }
+
+    sum = 0;
+    for (size_t i = 0; i < replyLength - 1; i++)
+        sum += reply[i];
+    reply[replyLength - 1] = sum;
+
+    queueReply(device, reply, replyLength);
+}
+
+
+
+void receiveByte(simDevice_t * device, uint8_t byte)
+{
+    static const uint8_t ack = 0x05;
+
+
+    switch (device->state)
+    {
+    case simWritingEDID:
+        device->writeBuffer[device->writeReceived++] = byte;
+        if (device->writeReceived == SIM_BLOCK_SIZE)
+            device->writeExpected = (1 + (device->writeBuffer[SIM_EXTENSION_COUNT_OFFSET] ? 1 : 0)) * SIM_BLOCK_SIZE;
+        if (device->writeReceived % SIM_BLOCK_SIZE == 0)
+            queueReply(device, &ack, 1);
+        if (device->writeReceived == device->writeExpected)
+        {
+            memcpy(device->sets[device->currentSet], device->writeBuffer, SIM_MAX_EDID_SIZE);
+            if (corruptedWriteCount > 0)
+            {
+                // as a flaky EEPROM would, in the last block received
+                device->sets[device->currentSet][device->writeExpected - SIM_BLOCK_SIZE + 0x20] ^= 0x01;
+                corruptedWriteCount--;
+            }
+            device->state = simIdle;
+        }
+        return;
+
+    case simFirmwareFrame:
+        device->frame[device->frameReceived++] = byte;
+        if (device->frameReceived == 3)
+        {
+            device->frameExpected = firmwareCommandLength(byte);
+            if (device->frameExpected == 0)
+            {
+                fprintf(stderr, "%s: unknown firmware command 0x%02x\n", device->path, byte);
+                device->state = simIdle;
+            }
+        }
+        if (device->frameReceived > 3 && device->frameReceived == device->frameExpected)
+        {
+            receiveFirmwareFrame(device);
+            device->state = simIdle;
+        }
+        return;
+
+    case simIdle:
+        break;
+    }
+
+    if (lostCommandCount > 0 && byte != 'F')
+    {
+        lostCommandCount--;
+        if (verbose)
+            printf("%ju %s: command 0x%02x lost\n", monotonicMilliseconds(), device->path, byte);
+        return;
+    }
+
+    device->commandCount++;
+    if (verbose)
+        printf("%ju %s: command 0x%02x\n", monotonicMilliseconds(), device->path, byte);
+
+    switch (byte)
+    {
+    case 0x01:
+    case 0x02:
+    case 0x03:
+    case 0x04:
+        device->currentSet = byte - 0x01;
+        break;
+
+    case 0x05:
+        if (device->readEDID != NULL && device->nextBlock <= device->readEDID[SIM_EXTENSION_COUNT_OFFSET] && device->nextBlock < SIM_MAX_EDID_SIZE / SIM_BLOCK_SIZE)
+            queueReply(device, device->readEDID + SIM_BLOCK_SIZE * device->nextBlock++, SIM_BLOCK_SIZE);
+        break;
+
+    case 0x07:
+    case 0x0c:
+        device->readEDID = (byte == 0x07) ? device->display : device->sets[device->currentSet];
+        device->nextBlock = 1;
+        queueReply(device, &ack, 1);
+        queueReply(device, device->readEDID, SIM_BLOCK_SIZE);
+        break;
+
+    case 0x08:
+        device->cec = 1;
+        break;
+
+    case 0x09:
+        device->cec = 0;
+        break;
+
+    case 0x0a:
+        device->state = simWritingEDID;
+        device->writeReceived = 0;
+        device->writeExpected = SIM_BLOCK_SIZE;
+        bzero(device->writeBuffer, sizeof(device->writeBuffer));
+        queueReply(device, &ack, 1);
+        break;
+
+    case 0x0b:
+        queueReply(device, &deviceType, 1);
+        break;
+
+    case 'F':
+        device->state = simFirmwareFrame;
+        device->frame[0] = byte;
+        device->frameReceived = 1;
+        device->frameExpected = SIM_MAX_FRAME_SIZE;
+        break;
+
+    default:
+        if (verbose)
+            printf("%s: unknown command 0x%02x dismissed\n", device->path, byte);
+        break;
+    }
+}
+
+
+
+static void stop(int signalNumber)
+{
+    quit = 1;
+}
+
+
+
+static void reload(int signalNumber)
+{
+    reloadDisplay = 1;
+}
+
+
+
+int main(int argc, char * const argv[])
+{
+    int character;
+    long deviceCount = 1;
+    char * setPath = NULL;
+    char * displayPath = NULL;
+    uint8_t setEDID[SIM_MAX_EDID_SIZE];
+    uint8_t displayEDID[SIM_MAX_EDID_SIZE];
+    simDevice_t * devices;
+    struct pollfd * pollDescriptors;
+    struct rlimit limit;
+
+
+    while ((character = getopt(argc, argv, "?E:c:e:l:n:rt:vx:")) != -1)
+    {
+        switch(character)
+        {
+        case 'E':
+            displayPath = optarg;
+            break;
+        case 'c':
+            corruptedWriteCount = strtol(optarg, NULL, 0);
+            break;
+        case 'e':
+            setPath = optarg;
+            break;
+        case 'l':
+            latency = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            deviceCount = strtol(optarg, NULL, 0);
+            break;
+        case 'r':
+            forgetFirmwareUpload = 1;
+            break;
+        case 't':
+            deviceType = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'x':
+            lostCommandCount = strtol(optarg, NULL, 0);
+            break;
+        case '?':
+        default:
+            usage();
+            exit(1);
+            break;
+        }
+    }
+
+    if (optind != argc || deviceCount < 1)
+    {
+        usage();
+        exit(1);
+    }
+
+    if (setPath == NULL)
+        makeDefaultEDID(setEDID, "VC080 SIM", 0);
+    else if (loadEDID(setEDID, setPath) != 0)
+    {
+        printf("%s: invalid EDID file\n", setPath);
+        exit(1);
+    }
+
+    if (displayPath == NULL)
+        makeDefaultEDID(displayEDID, "SIM DISPLAY", 1);
+    else if (loadEDID(displayEDID, displayPath) != 0)
+    {
+        printf("%s: invalid EDID file\n", displayPath);
+        exit(1);
+    }
+
+    // each device uses two descriptors
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t) (2 * deviceCount + 16))
+    {
+        limit.rlim_cur = 2 * deviceCount + 16;
+        if (limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max)
+            limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    devices = calloc(deviceCount, sizeof(simDevice_t));
+    pollDescriptors = calloc(deviceCount, sizeof(struct pollfd));
+    if (devices == NULL || pollDescriptors == NULL)
+    {
+        perror("atenvc080sim");
+        exit(1);
+    }
+
+    for (long i = 0; i < deviceCount; i++)
+    {
+        if (openDevice(&devices[i]) != 0)
+        {
+            perror("openpty");
+            exit(1);
+        }
+        for (int set = 0; set < SIM_SET_COUNT; set++)
+            memcpy(devices[i].sets[set], setEDID, SIM_MAX_EDID_SIZE);
+        memcpy(devices[i].display, displayEDID, SIM_MAX_EDID_SIZE);
+        devices[i].firmwareChunk = -1;
+        printf("%s\n", devices[i].path);
+    }
+    fflush(stdout);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    signal(SIGUSR1, reload);
+
+    while (!quit)
+    {
+        uintmax_t now = monotonicMilliseconds();
+        uintmax_t nextDue = UINTMAX_MAX;
+        int timeout;
+
+
+        if (reloadDisplay)
+        {
+            // as if another display was connected
+            reloadDisplay = 0;
+            if (displayPath != NULL && loadEDID(displayEDID, displayPath) == 0)
+            {
+                for (long i = 0; i < deviceCount; i++)
+                    memcpy(devices[i].display, displayEDID, SIM_MAX_EDID_SIZE);
+            }
+            else
+                fprintf(stderr, "display EDID not reloaded\n");
+        }
+
+        for (long i = 0; i < deviceCount; i++)
+        {
+            flushReplies(&devices[i], now);
+
+            pollDescriptors[i].fd = devices[i].master;
+            pollDescriptors[i].events = POLLIN;
+            if (devices[i].outputLength > 0 && devices[i].replies[0].due <= now)
+                pollDescriptors[i].events |= POLLOUT;       // the tty buffer is full, retry once it drains
+            else if (devices[i].replyCount > 0 && devices[i].replies[0].due < nextDue)
+                nextDue = devices[i].replies[0].due;
+        }
+
+        timeout = (nextDue == UINTMAX_MAX) ? -1 : (int) (nextDue - now);
+        if (poll(pollDescriptors, deviceCount, timeout) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            break;
+        }
+
+        for (long i = 0; i < deviceCount; i++)
+        {
+            uint8_t bytes[256];
+            ssize_t byteCount;
+
+
+            if ((pollDescriptors[i].revents & POLLIN) == 0)
+                continue;
+
+            byteCount = read(devices[i].master, bytes, sizeof(bytes));
+            for (ssize_t j = 0; j < byteCount; j++)
+                receiveByte(&devices[i], bytes[j]);
+        }
+    }
+
+    for (long i = 0; i < deviceCount; i++)
+    {
+        fprintf(stderr, "%s: %lu commands\n", devices[i].path, devices[i].commandCount);
+        close(devices[i].master);
+        close(devices[i].slave);
+    }
+
+    free(devices);
+    free(pollDescriptors);
+
+    return 0;
+}